@@ -0,0 +1,774 @@
+/*
+ * File   : bench.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the Modbus master load generator. Each
+ *               connection is one thread in a closed loop: send a read,
+ *               wait for its response, record the latency, repeat. The
+ *               per-thread histograms are summed up after each level.
+ *               The reconnect storm lets all clients connect at the same
+ *               time, each one retries until its first read is answered.
+ *               The image benchmark reads the shared-memory register image
+ *               through the reader library, for comparison with the
+ *               loopback round trip of a read answered from the image.
+ *               The consistency check writes registers while a read of them
+ *               is in flight and expects every later read to see the write.
+ */
+
+#include "bench.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#include "cli.h"
+#include "comm.h"
+#include "crc.h"
+#include "endian.h"
+#include "frame.h"
+#include "stats.h"
+#include "image_reader.h"
+
+#define BENCH_MAX_LEVELS    16
+#define BENCH_UNIT          1
+#define STORM_MAX_CLIENTS   10000
+#define STORM_RETRY_MS      100     // Pause of a client after a refused or closed connection
+#define STORM_STACK_SIZE    (64 * 1024)
+#define IMAGE_CHECK_READS   1024    // Reads between checks of the end of the level
+#define CRC_VERIFY_FRAMES   200000  // Random frames compared against the bitwise CRC
+#define CRC_BATCH           4096    // Frames between checks of the end of a size
+#define FRAME_RECORDED      20000   // Responses in the recorded stream of the parser benchmark
+#define CHECK_SETTLE_MS     50      // Consistency check: time for a request or a late response to arrive
+
+
+struct bench_conn {
+    struct bench* bench;
+    int index;
+    HANDLE thread;
+
+    struct histogram latency;       // Written by the connection thread only
+    uint64_t requests;
+    uint64_t errors;
+};
+
+struct bench {
+    boolean rtu;                    // TRUE: RTU over TCP, FALSE: Modbus TCP
+    struct addrinfo* addr;
+    int quantity;                   // Registers per read
+    volatile LONG running;
+};
+
+
+/// @brief One client of the reconnect storm
+struct storm_client {
+    struct bench* bench;
+    HANDLE go;                      // Manual-reset, releases all clients at once
+    uint64_t start_us;              // Set before go is signaled
+    uint64_t deadline_us;
+
+    uint64_t served_us;             // Storm start until the first read is answered, 0 never
+    int attempts;                   // Connections tried
+};
+
+/// @brief One reader thread of the image benchmark
+struct image_bench {
+    struct image_reader* reader;
+    int quantity;                   // Registers/coils per read, at most the block size
+    volatile LONG* running;
+    HANDLE thread;
+
+    uint64_t reads;                 // Written by the reader thread only
+    uint64_t errors;
+    uint64_t age_max_us;            // Oldest data read
+};
+
+
+/// @brief xorshift32, reproducible test data independent of the C runtime
+static uint32_t bench_random(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/// @brief Modbus CRC bit by bit, reference for crc16()
+static uint16_t crc16_bitwise(const uint8_t* data, uint16_t length) {
+    uint16_t crc = 0xFFFF;
+    while (length--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+            crc = crc & 0x0001 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+/// @brief Check response of a holding register read
+static boolean bench_valid(const uint8_t* rsp, int rsp_len, int quantity) {
+    return rsp_len == 3 + 2*quantity && rsp[0] == BENCH_UNIT && rsp[1] == 0x03 && rsp[2] == 2*quantity;
+}
+
+/// @brief Frame read of quantity holding registers at address
+/// @return Request length
+static int bench_request(struct bench* b, uint8_t* req, uint16_t address, uint16_t transactionId) {
+    uint8_t* pdu = b->rtu ? req : req + MBAP_LEN;
+    pdu[0] = BENCH_UNIT;
+    pdu[1] = 0x03;
+    pdu[2] = address >> 8;
+    pdu[3] = address & 0xFF;
+    pdu[4] = b->quantity >> 8;
+    pdu[5] = b->quantity & 0xFF;
+    if (b->rtu) {
+        uint16_t crc = crc16(pdu, 6);
+        memcpy(pdu +6, &crc, sizeof(crc));
+        return 8;
+    }
+    req[0] = transactionId >> 8;
+    req[1] = transactionId & 0xFF;
+    req[2] = 0;
+    req[3] = 0;
+    req[4] = 0;
+    req[5] = 6;
+    return MBAP_LEN + 6;
+}
+
+static DWORD WINAPI bench_connection(LPVOID lpParam) {
+    struct bench_conn* c = lpParam;
+    struct bench* b = c->bench;
+    uint8_t req[MBAP_LEN + 8];
+    uint8_t rsp[MBAP_LEN + BUFFER_SIZE];
+    struct rtu_stream stream = {0};
+    uint16_t transactionId = 0;
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    DWORD timeout = TCP_TIMEOUT;
+    BOOL nodelay = TRUE;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+    if (connect(sock, b->addr->ai_addr, (int)b->addr->ai_addrlen) != 0) {
+        log_efln("Bench connection %d: connect failed: %s", c->index, GetLastErrorString(FALSE));
+        closesocket(sock);
+        c->errors++;
+        return 0;
+    }
+
+    while (b->running) {
+        // Read holding registers, each connection walks its own address range
+        uint16_t address = (uint16_t)(c->index * 1000 + (c->requests % 100) * b->quantity);
+        int req_len = bench_request(b, req, address, ++transactionId);
+
+        uint64_t start_us = time_us();
+        if (send_all(sock, req, req_len) != req_len)
+            break;
+        int rsp_len;
+        boolean valid;
+        if (b->rtu) {
+            rsp_len = recv_rtu(sock, &stream, rsp);
+            valid = rsp_len > 0 && bench_valid(rsp, rsp_len -2, b->quantity);
+        } else {
+            rsp_len = recv_mbap(sock, rsp, sizeof(rsp));
+            valid = rsp_len > 0 && read_uint16_reverse(rsp) == transactionId
+                && bench_valid(rsp + MBAP_LEN, rsp_len - MBAP_LEN, b->quantity);
+        }
+        if (rsp_len <= 0) {
+            c->errors++;
+            break;                      // Connection unusable (timeout or closed)
+        }
+        histogram_record(&c->latency, time_us() - start_us);
+        c->requests++;
+        if (!valid)
+            c->errors++;
+    }
+    closesocket(sock);
+    return 0;
+}
+
+/// @brief Reconnect storm client: connect, one read, retry on refusal or close until answered
+static DWORD WINAPI storm_client(LPVOID lpParam) {
+    struct storm_client* c = lpParam;
+    struct bench* b = c->bench;
+    uint8_t req[MBAP_LEN + 8];
+    uint8_t rsp[MBAP_LEN + BUFFER_SIZE];
+
+    WaitForSingleObject(c->go, INFINITE);
+    while (time_us() < c->deadline_us) {
+        if (c->attempts++)
+            Sleep(STORM_RETRY_MS);
+        SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        DWORD timeout = TCP_TIMEOUT;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+        if (connect(sock, b->addr->ai_addr, (int)b->addr->ai_addrlen) != 0) {
+            closesocket(sock);
+            continue;
+        }
+        int req_len = bench_request(b, req, 0, 1);
+        struct rtu_stream stream = {0};
+        int rsp_len = send_all(sock, req, req_len) == req_len
+            ? (b->rtu ? recv_rtu(sock, &stream, rsp) : recv_mbap(sock, rsp, sizeof(rsp)))
+            : enSIMPLE_TCP_disconnected;
+        closesocket(sock);
+        if (rsp_len > 0 && (b->rtu ? bench_valid(rsp, rsp_len -2, b->quantity)
+                : bench_valid(rsp + MBAP_LEN, rsp_len - MBAP_LEN, b->quantity))) {
+            c->served_us = time_us() - c->start_us;
+            break;
+        }
+    }
+    return 0;
+}
+
+int bench_storm_main(int argc, char* argv[]) {
+    if (argc < 3 || (strcmp(argv[0], "tcp") != 0 && strcmp(argv[0], "rtu") != 0)) {
+        log_ln("Usage: storm tcp|rtu <host> <port> [clients] [seconds]");
+        return 1;
+    }
+    struct bench b = {0};
+    b.rtu = strcmp(argv[0], "rtu") == 0;
+    b.quantity = 10;
+    int clients = argc > 3 ? atoi(argv[3]) : 1000;
+    int seconds = argc > 4 ? atoi(argv[4]) : 60;
+    if (clients < 1 || clients > STORM_MAX_CLIENTS || seconds < 1) {
+        log_eln("Storm: invalid clients or seconds");
+        return 1;
+    }
+
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2,2), &wsa);
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct storm_client* c = calloc(clients, sizeof(struct storm_client));
+    HANDLE* threads = calloc(clients, sizeof(HANDLE));
+    HANDLE go = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!c || !threads || !go || getaddrinfo(argv[1], argv[2], &hints, &b.addr) != 0 || !b.addr) {
+        log_efln("Storm: setup for %s:%s failed: %s", argv[1], argv[2], GetLastErrorString(FALSE));
+        free(c);
+        free(threads);
+        WSACleanup();
+        return 1;
+    }
+
+    // Threads are ready and waiting before the storm starts, so it is not paced by thread creation
+    for (int i = 0; i < clients; i++) {
+        c[i].bench = &b;
+        c[i].go = go;
+        threads[i] = CreateThread(NULL, STORM_STACK_SIZE, storm_client, &c[i], STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+    }
+    Sleep(500);
+    log_fln("Storm of %d %s clients -> %s:%s, each retries every %d ms until its first read is answered",
+        clients, b.rtu ? "RTU over TCP" : "Modbus TCP", argv[1], argv[2], STORM_RETRY_MS);
+    uint64_t start_us = time_us();
+    for (int i = 0; i < clients; i++) {
+        c[i].start_us = start_us;
+        c[i].deadline_us = start_us + seconds * 1000000ULL;
+    }
+    SetEvent(go);
+
+    struct histogram served = {0};
+    int served_count = 0, retried = 0;
+    uint64_t attempts = 0, last_us = 0;
+    for (int i = 0; i < clients; i++) {
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+        attempts += c[i].attempts;
+        if (c[i].attempts > 1)
+            retried++;
+        if (!c[i].served_us)
+            continue;
+        served_count++;
+        histogram_record(&served, c[i].served_us);
+        if (c[i].served_us > last_us)
+            last_us = c[i].served_us;
+    }
+
+    log_ln("   Clients     Served    Retried   Attempts    All served s    p50 ms    p99 ms    max ms");
+    log_fln("%10d %10d %10d %10llu %15.3f %9.3f %9.3f %9.3f", clients, served_count, retried, (unsigned long long)attempts,
+        served_count == clients ? last_us / 1e6 : -1.0, histogram_percentile(&served, 0.50) / 1e3,
+        histogram_percentile(&served, 0.99) / 1e3, last_us / 1e3);
+
+    CloseHandle(go);
+    free(threads);
+    free(c);
+    freeaddrinfo(b.addr);
+    WSACleanup();
+    return served_count == clients ? 0 : 2;
+}
+
+/// @brief Image reader: reads from all blocks in turn until the level ends
+static DWORD WINAPI image_bench_thread(LPVOID lpParam) {
+    struct image_bench* ib = lpParam;
+    int count = image_block_count(ib->reader);
+    uint16_t values[2000];
+    uint64_t updated_us;
+
+    for (int i = 0; *ib->running; i++) {
+        const struct image_block* b = image_block(ib->reader, i % count);
+        int quantity = ib->quantity < b->quantity ? ib->quantity : b->quantity;
+        if (image_read(ib->reader, b->unit, b->function_code, b->address, (uint16_t)quantity, values, &updated_us) == 0) {
+            ib->reads++;
+            if (i % IMAGE_CHECK_READS == 0 && image_now_us() - updated_us > ib->age_max_us)
+                ib->age_max_us = image_now_us() - updated_us;
+        } else {
+            ib->errors++;
+        }
+    }
+    return 0;
+}
+
+int bench_image_main(int argc, char* argv[]) {
+    if (argc < 1) {
+        log_ln("Usage: image <name> [threads,...] [seconds] [quantity]");
+        return 1;
+    }
+    const char* levels = argc > 1 ? argv[1] : "1,4";
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    int quantity = argc > 3 ? atoi(argv[3]) : 10;
+    struct image_reader reader;
+    if (seconds < 1 || quantity < 1 || quantity > 2000) {
+        log_eln("Image bench: invalid seconds or quantity");
+        return 1;
+    }
+    if (image_open(&reader, argv[0]) || !image_block_count(&reader)) {
+        log_efln("Image bench: register image %s not published or empty (gateway with --image-shm running, --poll or master reads?)", argv[0]);
+        return 1;
+    }
+
+    log_fln("Image bench %s: %d blocks of gateway process %lu, read of up to %d registers/coils, %d s per level",
+        argv[0], image_block_count(&reader), (unsigned long)reader.header->gateway_pid, quantity, seconds);
+    log_ln("    Threads      Reads     Reads/s   ns/read   Max age ms   Invalid");
+    char* list = _strdup(levels);
+    int level_count = 0;
+    for (char* level = strtok(list, ","); level && level_count < BENCH_MAX_LEVELS; level = strtok(NULL, ","), level_count++) {
+        int threads = atoi(level);
+        struct image_bench* ib = threads > 0 ? calloc(threads, sizeof(struct image_bench)) : NULL;
+        if (!ib)
+            continue;
+        volatile LONG running = 1;
+        uint64_t start_us = time_us();
+        for (int i = 0; i < threads; i++) {
+            ib[i].reader = &reader;
+            ib[i].quantity = quantity;
+            ib[i].running = &running;
+            ib[i].thread = CreateThread(NULL, 0, image_bench_thread, &ib[i], 0, NULL);
+        }
+        Sleep(seconds * 1000);
+        InterlockedExchange(&running, 0);
+
+        uint64_t reads = 0, errors = 0, age_max_us = 0;
+        for (int i = 0; i < threads; i++) {
+            if (ib[i].thread) {
+                WaitForSingleObject(ib[i].thread, INFINITE);
+                CloseHandle(ib[i].thread);
+            }
+            reads += ib[i].reads;
+            errors += ib[i].errors;
+            if (ib[i].age_max_us > age_max_us)
+                age_max_us = ib[i].age_max_us;
+        }
+        double elapsed = (time_us() - start_us) / 1e6;
+        log_fln("%11d %10llu %11.0f %9.1f %12.3f %9llu", threads, (unsigned long long)reads, reads / elapsed,
+            reads ? elapsed * 1e9 * threads / reads : 0.0, age_max_us / 1e3, (unsigned long long)errors);
+        free(ib);
+    }
+    free(list);
+    image_close(&reader);
+    return 0;
+}
+
+int bench_crc_main(int argc, char* argv[]) {
+    static const int sizes[] = { 8, 64, 256 };
+    double seconds = argc > 0 ? atof(argv[0]) : 1.0;
+    uint8_t data[RTU_MAX_LEN * 2];
+    uint32_t seed = 0x4D425553;
+
+    if (seconds <= 0) {
+        log_eln("CRC bench: invalid seconds");
+        return 1;
+    }
+
+    // Bit-exact against the bitwise implementation, all lengths and random contents
+    for (int i = 0; i < CRC_VERIFY_FRAMES; i++) {
+        uint16_t len = (uint16_t)(bench_random(&seed) % sizeof(data));
+        for (int j = 0; j < len; j++)
+            data[j] = (uint8_t)bench_random(&seed);
+        if (crc16(data, len) != crc16_bitwise(data, len)) {
+            log_efln("CRC bench: mismatch on frame %d (%u bytes): %04X, bitwise %04X", i, len, crc16(data, len), crc16_bitwise(data, len));
+            return 2;
+        }
+    }
+    log_fln("CRC bench: %d random frames of 0-%u bytes match the bitwise CRC, %.1f s per size", CRC_VERIFY_FRAMES, (unsigned)sizeof(data) -1, seconds);
+
+    log_ln("      Bytes      Frames/s      MB/s   ns/frame  Bitwise MB/s");
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        double mb_s[2];
+        uint64_t frames[2];
+        volatile uint16_t sink = 0;     // Keeps the loop from being optimized away
+        for (int j = 0; j < sizes[i]; j++)
+            data[j] = (uint8_t)bench_random(&seed);
+        for (int bitwise = 0; bitwise < 2; bitwise++) {
+            uint64_t start_us = time_us(), end_us = start_us + (uint64_t)(seconds * 1e6 / 2), now_us;
+            frames[bitwise] = 0;
+            do {
+                for (int k = 0; k < CRC_BATCH; k++) {
+                    data[0] = (uint8_t)k;   // Differs per frame like real traffic
+                    sink ^= bitwise ? crc16_bitwise(data, (uint16_t)sizes[i]) : crc16(data, (uint16_t)sizes[i]);
+                }
+                frames[bitwise] += CRC_BATCH;
+                now_us = time_us();
+            } while (now_us < end_us);
+            mb_s[bitwise] = frames[bitwise] * sizes[i] / (double)(now_us - start_us);
+        }
+        log_fln("%11d %13.0f %9.1f %10.1f %13.1f", sizes[i], mb_s[0] * 1e6 / sizes[i], mb_s[0], 1e3 * sizes[i] / mb_s[0], mb_s[1]);
+    }
+    return 0;
+}
+
+/// @brief Append one random slave response with CRC, mix of reads, writes, exceptions,
+/// @brief diagnostics, FIFO and device identification as seen on a busy bus
+/// @return Length of the frame
+static int frame_record(uint8_t* frame, uint32_t* seed) {
+    static const uint8_t function_codes[] = { 0x03, 0x03, 0x03, 0x04, 0x01, 0x02, 0x06, 0x10, 0x05, 0x0F, 0x83, 0x90, 0x08, 0x16, 0x17, 0x18, 0x2B };
+    uint8_t fc = function_codes[bench_random(seed) % sizeof(function_codes)];
+    int len = 2;
+
+    for (int i = 2; i < RTU_MAX_LEN -2; i++)
+        frame[i] = (uint8_t)bench_random(seed);     // Values, the fields giving the length are set below
+    frame[0] = (uint8_t)(1 + bench_random(seed) % 247);
+    frame[1] = fc;
+    switch (fc) {
+        case 0x01: case 0x02:
+            frame[len++] = (uint8_t)(1 + bench_random(seed) % 250);
+            len += frame[2];
+            break;
+        case 0x03: case 0x04: case 0x17:
+            frame[len++] = (uint8_t)(2 * (1 + bench_random(seed) % 125));
+            len += frame[2];
+            break;
+        case 0x83: case 0x90:
+            len++;
+            break;
+        case 0x16:
+            len += 6;
+            break;
+        case 0x18: {
+            int count = bench_random(seed) % 32;
+            frame[len++] = (uint8_t)((2 + 2 * count) >> 8);
+            frame[len++] = (uint8_t)(2 + 2 * count);
+            frame[len++] = 0;
+            frame[len++] = (uint8_t)count;
+            len += 2 * count;
+            break;
+        }
+        case 0x2B: {
+            // MEI type, read code, conformity, more follows, next object, number of objects
+            uint8_t objects = (uint8_t)(1 + bench_random(seed) % 3);
+            memcpy(frame + len, (uint8_t[]){ 0x0E, 0x01, 0x01, 0x00, 0x00, objects }, 6);
+            len += 6;
+            for (int i = 0; i < objects; i++) {
+                frame[len++] = (uint8_t)i;
+                frame[len++] = (uint8_t)(1 + bench_random(seed) % 40);
+                len += frame[len -1];
+            }
+            break;
+        }
+        default:            // 0x05, 0x06, 0x08, 0x0F, 0x10: address/sub-function and value/quantity
+            len += 4;
+            break;
+    }
+    if (fc & 0x80)
+        frame[2] = (uint8_t)(1 + bench_random(seed) % 11);
+    uint16_t crc = crc16(frame, (uint16_t)len);
+    frame[len++] = (uint8_t)crc;
+    frame[len++] = (uint8_t)(crc >> 8);
+    return len;
+}
+
+int bench_frame_main(int argc, char* argv[]) {
+    static const int segments[] = { 8, 64, 512 };
+    double seconds = argc > 0 ? atof(argv[0]) : 1.0;
+    uint32_t seed = 0x52545553;
+
+    if (seconds <= 0) {
+        log_eln("Frame bench: invalid seconds");
+        return 1;
+    }
+
+    // Record the stream once, every level parses the same bytes
+    uint8_t* stream = malloc((size_t)FRAME_RECORDED * RTU_MAX_LEN);
+    int* lengths = malloc(FRAME_RECORDED * sizeof(int));
+    int stream_len = 0;
+    if (!stream || !lengths) {
+        free(stream);
+        free(lengths);
+        return 1;
+    }
+    for (int i = 0; i < FRAME_RECORDED; i++) {
+        lengths[i] = frame_record(stream + stream_len, &seed);
+        stream_len += lengths[i];
+    }
+    log_fln("Frame bench: %d recorded responses (%d bytes) in random segments, %.1f s per level", FRAME_RECORDED, stream_len, seconds);
+    log_ln("   Segments      Frames/s      MB/s   ns/frame     Errors");
+
+    int result = 0;
+    for (int i = 0; i < (int)(sizeof(segments) / sizeof(segments[0])); i++) {
+        struct rtu_stream s = {0};
+        uint8_t frame[RTU_MAX_LEN];
+        uint64_t frames = 0, bytes = 0, errors = 0;
+        uint64_t start_us = time_us(), end_us = start_us + (uint64_t)(seconds * 1e6), now_us;
+        do {
+            // One pass over the recorded stream, cut like recv() would
+            int pos = 0, offset = 0;
+            s.len = 0;
+            for (int next = 0; next < FRAME_RECORDED && !errors; ) {
+                int segment = 1 + bench_random(&seed) % segments[i];
+                if (segment > stream_len - pos)
+                    segment = stream_len - pos;
+                if (segment > (int)sizeof(s.buf) - s.len)
+                    segment = (int)sizeof(s.buf) - s.len;
+                memcpy(s.buf + s.len, stream + pos, segment);
+                s.len += segment;
+                pos += segment;
+
+                int frame_len;
+                while (next < FRAME_RECORDED && (frame_len = rtu_stream_frame(&s, rtu_response_length, frame)) != 0) {
+                    if (frame_len != lengths[next] || memcmp(frame, stream + offset, frame_len) != 0) {
+                        errors++;       // Lost sync, the rest of the pass would only repeat it
+                        break;
+                    }
+                    offset += lengths[next++];
+                    frames++;
+                }
+                if (pos == stream_len && next < FRAME_RECORDED && !errors) {
+                    errors++;           // Stream ended inside a frame
+                    break;
+                }
+            }
+            bytes += offset;
+            now_us = time_us();
+        } while (now_us < end_us && !errors);
+        double elapsed_us = (double)(now_us - start_us);
+        log_fln("%11d %13.0f %9.1f %10.1f %10llu", segments[i], frames * 1e6 / elapsed_us, bytes / elapsed_us,
+            frames ? elapsed_us * 1e3 / frames : 0.0, (unsigned long long)errors);
+        if (errors)
+            result = 2;
+    }
+    free(stream);
+    free(lengths);
+    return result;
+}
+
+/// @brief Connection of the consistency check
+/// @return Socket or INVALID_SOCKET
+static SOCKET check_connect(struct bench* b) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    DWORD timeout = TCP_TIMEOUT;
+    BOOL nodelay = TRUE;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+    if (sock != INVALID_SOCKET && connect(sock, b->addr->ai_addr, (int)b->addr->ai_addrlen) != 0) {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+    return sock;
+}
+
+/// @brief Send request of 6 bytes unit id + PDU, framed as Modbus TCP or RTU
+/// @return TRUE if sent
+static boolean check_send(struct bench* b, SOCKET sock, const uint8_t* pdu, uint16_t transactionId) {
+    uint8_t req[MBAP_LEN + 6];
+    int req_len;
+    if (b->rtu) {
+        memcpy(req, pdu, 6);
+        uint16_t crc = crc16(req, 6);
+        memcpy(req +6, &crc, sizeof(crc));
+        req_len = 8;
+    } else {
+        req[0] = transactionId >> 8;
+        req[1] = transactionId & 0xFF;
+        req[2] = 0;
+        req[3] = 0;
+        req[4] = 0;
+        req[5] = 6;
+        memcpy(req + MBAP_LEN, pdu, 6);
+        req_len = MBAP_LEN + 6;
+    }
+    return send_all(sock, req, req_len) == req_len;
+}
+
+/// @brief Receive the next response
+/// @param rsp Buffer (MBAP_LEN + BUFFER_SIZE)
+/// @param pdu Set to unit id + PDU inside rsp
+/// @return Length of unit id + PDU, <=0 error
+static int check_receive(struct bench* b, SOCKET sock, struct rtu_stream* stream, uint8_t* rsp, const uint8_t** pdu) {
+    int rsp_len = b->rtu ? recv_rtu(sock, stream, rsp) : recv_mbap(sock, rsp, MBAP_LEN + BUFFER_SIZE);
+    if (rsp_len <= 0)
+        return rsp_len;
+    *pdu = b->rtu ? rsp : rsp + MBAP_LEN;
+    return b->rtu ? rsp_len -2 : rsp_len - MBAP_LEN;
+}
+
+int bench_check_main(int argc, char* argv[]) {
+    if (argc < 3 || (strcmp(argv[0], "tcp") != 0 && strcmp(argv[0], "rtu") != 0)) {
+        log_ln("Usage: check tcp|rtu <host> <port> [address] [rounds]");
+        return 1;
+    }
+    struct bench b = {0};
+    b.rtu = strcmp(argv[0], "rtu") == 0;
+    int address = argc > 3 ? atoi(argv[3]) : 0;
+    int rounds = argc > 4 ? atoi(argv[4]) : 20;
+    if (address < 0 || rounds < 1 || address + rounds > 65536) {
+        log_eln("Check: invalid address or rounds");
+        return 1;
+    }
+
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2,2), &wsa);
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    SOCKET reader = INVALID_SOCKET, writer = INVALID_SOCKET;
+    if (getaddrinfo(argv[1], argv[2], &hints, &b.addr) != 0 || !b.addr
+            || (reader = check_connect(&b)) == INVALID_SOCKET || (writer = check_connect(&b)) == INVALID_SOCKET) {
+        log_efln("Check: connect to %s:%s failed: %s", argv[1], argv[2], GetLastErrorString(FALSE));
+        if (reader != INVALID_SOCKET)
+            closesocket(reader);
+        if (b.addr)
+            freeaddrinfo(b.addr);
+        WSACleanup();
+        return 1;
+    }
+
+    log_fln("Check %s master -> %s:%s, %d rounds from register %d: write while a read of it is in flight, read back",
+        b.rtu ? "RTU over TCP" : "Modbus TCP", argv[1], argv[2], rounds, address);
+    struct rtu_stream reader_stream = {0}, writer_stream = {0};
+    uint8_t rsp[MBAP_LEN + BUFFER_SIZE];
+    const uint8_t* pdu = NULL;
+    uint32_t seed = GetTickCount() | 1;
+    uint16_t transactionId = 0;
+    int stale = 0, errors = 0;
+    for (int i = 0; i < rounds && !errors; i++) {
+        uint16_t reg = (uint16_t)(address + i);     // Own register per round: the first read is no cache hit
+        uint16_t value = (uint16_t)bench_random(&seed);
+        uint8_t read[6] = { BENCH_UNIT, 0x03, reg >> 8, reg & 0xFF, 0, 1 };
+        uint8_t write[6] = { BENCH_UNIT, 0x06, reg >> 8, reg & 0xFF, value >> 8, value & 0xFF };
+
+        // The read goes upstream first, a reordering target (sim reorder_ms) answers the write before it
+        if (!check_send(&b, reader, read, ++transactionId)) {
+            errors++;
+            break;
+        }
+        Sleep(CHECK_SETTLE_MS);
+        if (!check_send(&b, writer, write, ++transactionId)
+                || check_receive(&b, writer, &writer_stream, rsp, &pdu) != 6 || memcmp(pdu, write, 6) != 0
+                || check_receive(&b, reader, &reader_stream, rsp, &pdu) != 5 || pdu[1] != 0x03) {
+            errors++;               // The read in flight may return the old or the new value
+            break;
+        }
+
+        // Once the write is answered every read has to return it
+        Sleep(CHECK_SETTLE_MS);
+        if (!check_send(&b, reader, read, ++transactionId)
+                || check_receive(&b, reader, &reader_stream, rsp, &pdu) != 5 || pdu[1] != 0x03) {
+            errors++;
+            break;
+        }
+        if (read_uint16_reverse(pdu +3) != value) {
+            stale++;
+            log_efln("Check: register %u reads %u after %u was written", reg, read_uint16_reverse(pdu +3), value);
+        }
+    }
+    log_fln("Check: %d stale reads, %d errors", stale, errors);
+
+    closesocket(reader);
+    closesocket(writer);
+    freeaddrinfo(b.addr);
+    WSACleanup();
+    return stale || errors ? 2 : 0;
+}
+
+/// @brief Run one concurrency level and print its result line
+static void bench_level(struct bench* b, int connections, int seconds) {
+    struct bench_conn* conns = calloc(connections, sizeof(struct bench_conn));
+    if (!conns) {
+        log_eln("Bench: malloc failed");
+        return;
+    }
+
+    b->running = 1;
+    uint64_t start_us = time_us();
+    for (int i = 0; i < connections; i++) {
+        conns[i].bench = b;
+        conns[i].index = i;
+        conns[i].thread = CreateThread(NULL, 0, bench_connection, &conns[i], 0, NULL);
+    }
+    Sleep(seconds * 1000);
+    InterlockedExchange(&b->running, 0);
+
+    struct histogram latency = {0};
+    uint64_t requests = 0, errors = 0;
+    for (int i = 0; i < connections; i++) {
+        if (conns[i].thread) {
+            WaitForSingleObject(conns[i].thread, INFINITE);
+            CloseHandle(conns[i].thread);
+        } else {
+            conns[i].errors++;
+        }
+        histogram_add(&latency, &conns[i].latency);
+        requests += conns[i].requests;
+        errors += conns[i].errors;
+    }
+    double elapsed = (time_us() - start_us) / 1e6;
+    free(conns);
+
+    log_fln("%11d %10llu %10.0f %9.3f %9.3f %9.3f %8llu", connections, (unsigned long long)requests, requests / elapsed,
+        histogram_percentile(&latency, 0.50) / 1e3, histogram_percentile(&latency, 0.99) / 1e3,
+        histogram_percentile(&latency, 0.999) / 1e3, (unsigned long long)errors);
+}
+
+int bench_main(int argc, char* argv[]) {
+    if (argc < 3 || (strcmp(argv[0], "tcp") != 0 && strcmp(argv[0], "rtu") != 0)) {
+        log_ln("Usage: bench tcp|rtu <host> <port> [connections,...] [seconds] [quantity]");
+        return 1;
+    }
+    struct bench b = {0};
+    b.rtu = strcmp(argv[0], "rtu") == 0;
+    const char* levels = argc > 3 ? argv[3] : "1,4,16,64";
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    b.quantity = argc > 5 ? atoi(argv[5]) : 10;
+    if (seconds < 1 || b.quantity < 1 || b.quantity > 125) {
+        log_eln("Bench: invalid seconds or quantity");
+        return 1;
+    }
+
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2,2), &wsa);
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[1], argv[2], &hints, &b.addr) != 0 || !b.addr) {
+        log_efln("Bench: address resolution of %s:%s failed: %s", argv[1], argv[2], GetLastErrorString(FALSE));
+        WSACleanup();
+        return 1;
+    }
+
+    log_fln("Bench %s master -> %s:%s, read of %d registers, %d s per level (latency buckets +-19%%)",
+        b.rtu ? "RTU over TCP" : "Modbus TCP", argv[1], argv[2], b.quantity, seconds);
+    log_ln("Connections   Requests      Req/s    p50 ms    p99 ms   p999 ms   Errors");
+    char* list = _strdup(levels);
+    int count = 0;
+    for (char* level = strtok(list, ","); level && count < BENCH_MAX_LEVELS; level = strtok(NULL, ","), count++) {
+        int connections = atoi(level);
+        if (connections > 0)
+            bench_level(&b, connections, seconds);
+    }
+    free(list);
+
+    freeaddrinfo(b.addr);
+    WSACleanup();
+    return 0;
+}
@@ -0,0 +1,96 @@
+@echo off
+setlocal
+
+:: Show help if requested
+if "%~1"=="-h" goto :help
+if "%~1"=="/h" goto :help
+if "%~1"=="--help" goto :help
+if "%~1"=="/?" goto :help
+goto :start
+:help
+echo Usage: %~nx0 [CONNECTIONS] [SECONDS] [QUANTITY] [DELAY_MS] [BAUD]
+echo   Runs the gateway between load generator and slave simulator on loopback:
+echo   tcp mode, rtu mode and the chained tcp -^> rtu -^> slave setup,
+echo   then a reconnect storm of 1000 masters against the tcp mode gateway
+echo   and reads of a polled register image: Modbus TCP on loopback vs. shared memory,
+echo   the CRC16 throughput and the RTU frame parser on randomly segmented streams,
+echo   finally reads after writes against a slave answering out of order (response cache, polled image).
+echo   Defaults: CONNECTIONS 1,4,16,64  SECONDS 5  QUANTITY 10  DELAY_MS 0  BAUD 0 (no serial emulation)
+exit /b
+
+:start
+:: Change to script directory
+pushd "%~dp0"
+
+:: Configuration
+set GATEWAY=modbus_gateway.exe
+set CONNECTIONS=1,4,16,64
+set SECONDS=5
+set QUANTITY=10
+set DELAY_MS=0
+set BAUD=0
+set STORM=1000
+
+if not "%~1"=="" set CONNECTIONS=%~1
+if not "%~2"=="" set SECONDS=%~2
+if not "%~3"=="" set QUANTITY=%~3
+if not "%~4"=="" set DELAY_MS=%~4
+if not "%~5"=="" set BAUD=%~5
+
+:: Window titles identify the processes of this run for taskkill
+start "mbbench sim rtu" /min %GATEWAY% sim rtu 15020 %DELAY_MS% %BAUD%
+start "mbbench sim tcp" /min %GATEWAY% sim tcp 15021 %DELAY_MS% %BAUD%
+start "mbbench gateway tcp" /min %GATEWAY% tcp 15502 127.0.0.1 15020
+start "mbbench gateway rtu" /min %GATEWAY% rtu 15503 127.0.0.1 15021
+start "mbbench chain rtu" /min %GATEWAY% rtu 15504 127.0.0.1 15021
+start "mbbench chain tcp" /min %GATEWAY% tcp 15505 127.0.0.1 15504
+start "mbbench image" /min %GATEWAY% tcp 15506 127.0.0.1 15020 --poll=1:3:0:65000:1000 --image-shm=mbbench
+start "mbbench sim reorder" /min %GATEWAY% sim tcp 15022 0 0 200
+start "mbbench cache" /min %GATEWAY% rtu 15507 127.0.0.1 15022 --window=2 --cache-ttl=60000 --timeout=1000
+start "mbbench polled" /min %GATEWAY% rtu 15508 127.0.0.1 15022 --window=2 --timeout=1000 --poll=1:3:2000:100:50
+timeout /t 2 /nobreak >nul
+
+echo.
+echo === Baseline: Modbus TCP master -^> TCP slave simulator
+%GATEWAY% bench tcp 127.0.0.1 15021 %CONNECTIONS% %SECONDS% %QUANTITY%
+echo.
+echo === Baseline: RTU over TCP master -^> RTU slave simulator
+%GATEWAY% bench rtu 127.0.0.1 15020 %CONNECTIONS% %SECONDS% %QUANTITY%
+echo.
+echo === tcp mode: Modbus TCP master -^> gateway tcp -^> RTU slave simulator
+%GATEWAY% bench tcp 127.0.0.1 15502 %CONNECTIONS% %SECONDS% %QUANTITY%
+echo.
+echo === rtu mode: RTU over TCP master -^> gateway rtu -^> TCP slave simulator
+%GATEWAY% bench rtu 127.0.0.1 15503 %CONNECTIONS% %SECONDS% %QUANTITY%
+echo.
+echo === Chained: Modbus TCP master -^> gateway tcp -^> gateway rtu -^> TCP slave simulator
+%GATEWAY% bench tcp 127.0.0.1 15505 %CONNECTIONS% %SECONDS% %QUANTITY%
+
+echo.
+echo === Reconnect storm: %STORM% Modbus TCP masters connect at once -^> gateway tcp
+%GATEWAY% storm tcp 127.0.0.1 15502 %STORM%
+
+echo.
+echo === Register image: Modbus TCP master -^> gateway tcp, reads answered from the polled image
+%GATEWAY% bench tcp 127.0.0.1 15506 %CONNECTIONS% %SECONDS% %QUANTITY%
+echo.
+echo === Register image: shared memory through the reader library (image_reader.h)
+%GATEWAY% image mbbench %CONNECTIONS% %SECONDS% %QUANTITY%
+
+echo.
+echo === CRC16: lookup tables vs. bitwise
+%GATEWAY% crc
+echo.
+echo === RTU framing: recorded responses in random segments
+%GATEWAY% frame
+
+echo.
+echo === Out of order: RTU over TCP master -^> gateway rtu with cache -^> TCP slave simulator, writes overtake reads
+%GATEWAY% check rtu 127.0.0.1 15507 1000
+echo.
+echo === Out of order: RTU over TCP master -^> gateway rtu with polled image -^> TCP slave simulator, writes overtake polls
+%GATEWAY% check rtu 127.0.0.1 15508 2000
+
+taskkill /fi "WINDOWTITLE eq mbbench*" >nul 2>&1
+popd
+endlocal
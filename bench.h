@@ -0,0 +1,60 @@
+/*
+ * File   : bench.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the Modbus master load generator, the near
+ *               end of the loopback benchmark (see sim.h, bench.cmd)
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/// @brief Run load generator for each concurrency level and print throughput and latency
+/// @brief Arguments: tcp|rtu <host> <port> [connections,...] [seconds] [quantity]
+/// @param argc Number of arguments behind "bench"
+/// @param argv Arguments behind "bench"
+/// @return Exit code
+int bench_main(int argc, char* argv[]);
+
+/// @brief Reconnect storm: all clients connect at once and retry until their first read is answered,
+/// @brief print the time until all are served
+/// @brief Arguments: tcp|rtu <host> <port> [clients] [seconds]
+/// @param argc Number of arguments behind "storm"
+/// @param argv Arguments behind "storm"
+/// @return Exit code, 2 if not all clients were served within seconds
+int bench_storm_main(int argc, char* argv[]);
+
+/// @brief Read the shared-memory register image of a running gateway (--image-shm) through the
+/// @brief reader library for each thread count, print reads/s
+/// @brief Arguments: <name> [threads,...] [seconds] [quantity]
+/// @param argc Number of arguments behind "image"
+/// @param argv Arguments behind "image"
+/// @return Exit code
+int bench_image_main(int argc, char* argv[]);
+
+/// @brief Check crc16() bit-exact against the bitwise CRC, then print its throughput on
+/// @brief 8, 64 and 256 byte frames
+/// @brief Arguments: [seconds per size]
+/// @param argc Number of arguments behind "crc"
+/// @param argv Arguments behind "crc"
+/// @return Exit code, 2 on a mismatch
+int bench_crc_main(int argc, char* argv[]);
+
+/// @brief Parse a recorded stream of RTU responses fed in random segments (1-8, 1-64, 1-512 bytes)
+/// @brief through rtu_stream_frame, check every frame and print frames/s and MB/s
+/// @brief Arguments: [seconds per level]
+/// @param argc Number of arguments behind "frame"
+/// @param argv Arguments behind "frame"
+/// @return Exit code, 2 if a frame was not recovered intact
+int bench_frame_main(int argc, char* argv[]);
+
+/// @brief Consistency check: per round write a register while a read of it is in flight, then read
+/// @brief it back, which must return the written value (with sim reorder_ms the write overtakes the read)
+/// @brief Arguments: tcp|rtu <host> <port> [address] [rounds]
+/// @param argc Number of arguments behind "check"
+/// @param argv Arguments behind "check"
+/// @return Exit code, 2 on a stale read or an error
+int bench_check_main(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * File   : cache.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the TTL response cache. Set associative
+ *               table (CACHE_SETS x CACHE_WAYS), lookups from the reactor
+ *               threads, stores and invalidations from the target worker.
+ */
+
+#include "cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cli.h"
+#include "endian.h"
+
+
+/// @brief Check request is a cacheable read (0x01-0x04), returns its function code or 0
+static uint8_t cache_read_fc(const uint8_t* req, int req_len) {
+    if (req_len != 6 || req[1] < 0x01 || req[1] > 0x04)
+        return 0;
+    return req[1];
+}
+
+static unsigned cache_set(uint8_t unit, uint8_t function_code, uint16_t address, uint16_t quantity) {
+    uint32_t h = unit;
+    h = h * 31 + function_code;
+    h = h * 31 + address;
+    h = h * 31 + quantity;
+    h ^= h >> 13;
+    return ((h * 0x9E3779B1u) >> 16) % CACHE_SETS;
+}
+
+static int cache_match(const struct cache_entry* e, const uint8_t* req) {
+    return e->expires_us
+        && e->unit == req[0]
+        && e->function_code == req[1]
+        && e->address == read_uint16_reverse(req +2)
+        && e->quantity == read_uint16_reverse(req +4);
+}
+
+
+struct cache* cache_create() {
+    struct cache* c = calloc(1, sizeof(struct cache));
+    if (!c) {
+        log_efln("cache_create malloc failed: %s", GetLastErrorString(FALSE));
+        return NULL;
+    }
+    InitializeCriticalSection(&c->lock);
+    return c;
+}
+
+int cache_lookup(struct cache* c, const uint8_t* req, int req_len, uint8_t* rsp) {
+    if (!cache_read_fc(req, req_len))
+        return 0;
+
+    int rsp_len = 0;
+    struct cache_entry* set = c->entries[cache_set(req[0], req[1], read_uint16_reverse(req +2), read_uint16_reverse(req +4))];
+    uint64_t now = time_us();
+
+    EnterCriticalSection(&c->lock);
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (cache_match(&set[i], req) && set[i].expires_us > now) {
+            rsp_len = set[i].rsp_len;
+            memcpy(rsp, set[i].rsp, rsp_len);
+            break;
+        }
+    }
+    LeaveCriticalSection(&c->lock);
+
+    if (rsp_len)
+        InterlockedIncrement64(&c->hits);
+    else
+        InterlockedIncrement64(&c->misses);
+    return rsp_len;
+}
+
+void cache_store(struct cache* c, const uint8_t* req, int req_len, const uint8_t* rsp, int rsp_len, LONG64 writes) {
+    uint8_t function_code = cache_read_fc(req, req_len);
+    if (!function_code || rsp_len <= 2 || rsp[1] != function_code)
+        return;                 // Not a read or exception response
+    uint16_t address = read_uint16_reverse(req +2);
+    uint16_t quantity = read_uint16_reverse(req +4);
+    if (rsp_len != 1 + expected_pdu_length(function_code, quantity))
+        return;
+    int ttl_ms = config_cache_ttl(req[0], function_code);
+    if (ttl_ms <= 0)
+        return;
+
+    struct cache_entry* set = c->entries[cache_set(req[0], function_code, address, quantity)];
+    uint64_t now = time_us();
+
+    EnterCriticalSection(&c->lock);
+    if (c->writes != writes) {
+        LeaveCriticalSection(&c->lock);
+        return;                 // Any write, ranges are not compared: costs at most one more upstream read
+    }
+    // Same key, else a free or expired way, else the one expiring first
+    struct cache_entry* e = &set[0];
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (cache_match(&set[i], req)) {
+            e = &set[i];
+            break;
+        }
+        if (set[i].expires_us < e->expires_us || set[i].expires_us <= now)
+            e = &set[i];
+    }
+    e->unit = req[0];
+    e->function_code = function_code;
+    e->address = address;
+    e->quantity = quantity;
+    e->rsp_len = rsp_len;
+    memcpy(e->rsp, rsp, rsp_len);
+    e->expires_us = now + (uint64_t)ttl_ms * 1000;
+    LeaveCriticalSection(&c->lock);
+}
+
+void cache_invalidate(struct cache* c, const uint8_t* req, int req_len) {
+    uint8_t read_fc;
+    uint16_t address, quantity;
+
+    if (req_len < 6)
+        return;
+    switch (req[1]) {
+        case 0x05: // Write Single Coil
+            read_fc = 0x01; address = read_uint16_reverse(req +2); quantity = 1; break;
+        case 0x0F: // Write Multiple Coils
+            read_fc = 0x01; address = read_uint16_reverse(req +2); quantity = read_uint16_reverse(req +4); break;
+        case 0x06: // Write Single Register
+        case 0x16: // Mask Write Register
+            read_fc = 0x03; address = read_uint16_reverse(req +2); quantity = 1; break;
+        case 0x10: // Write Multiple Registers
+            read_fc = 0x03; address = read_uint16_reverse(req +2); quantity = read_uint16_reverse(req +4); break;
+        case 0x17: // Read/Write Multiple Registers
+            if (req_len < 10)
+                return;
+            read_fc = 0x03; address = read_uint16_reverse(req +6); quantity = read_uint16_reverse(req +8); break;
+        default:
+            return;
+    }
+
+    uint32_t end = (uint32_t)address + quantity;
+    EnterCriticalSection(&c->lock);
+    c->writes++;
+    for (int s = 0; s < CACHE_SETS; s++) {
+        for (int i = 0; i < CACHE_WAYS; i++) {
+            struct cache_entry* e = &c->entries[s][i];
+            if (e->expires_us && (e->unit == req[0] || req[0] == MODBUS_BROADCAST_UNIT) && e->function_code == read_fc
+                    && e->address < end && address < (uint32_t)e->address + e->quantity) {
+                e->expires_us = 0;
+                InterlockedIncrement64(&c->invalidations);
+            }
+        }
+    }
+    LeaveCriticalSection(&c->lock);
+}
@@ -0,0 +1,72 @@
+/*
+ * File   : cache.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the TTL response cache of read requests
+ *               (0x01-0x04) in front of slow targets
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+#include <windows.h>
+
+#include "comm.h"
+
+#define CACHE_SETS  64
+#define CACHE_WAYS  4
+
+
+/// @brief One cached response, keyed by unit id, function code, start address and quantity
+struct cache_entry {
+    uint8_t unit;
+    uint8_t function_code;
+    uint16_t address;
+    uint16_t quantity;
+    uint64_t expires_us;        // 0: unused
+    int rsp_len;
+    uint8_t rsp[BUFFER_SIZE];   // Unit id + PDU
+};
+
+struct cache {
+    CRITICAL_SECTION lock;
+    struct cache_entry entries[CACHE_SETS][CACHE_WAYS];
+    volatile LONG64 writes;     // Write requests seen by cache_invalidate, a read in flight across one is not stored
+
+    // Statistics
+    volatile LONG64 hits;
+    volatile LONG64 misses;
+    volatile LONG64 invalidations;
+};
+
+
+/// @brief Create cache
+/// @return Cache or NULL on error
+struct cache* cache_create();
+
+/// @brief Look up response for a read request
+/// @param c Cache
+/// @param req Request (unit id + PDU)
+/// @param req_len Length of request
+/// @param rsp Buffer for response (BUFFER_SIZE)
+/// @return >0 Length of response, 0 not cached
+int cache_lookup(struct cache* c, const uint8_t* req, int req_len, uint8_t* rsp);
+
+/// @brief Store response of a read request, if a TTL is configured for it
+/// @param c Cache
+/// @param req Request (unit id + PDU)
+/// @param req_len Length of request
+/// @param rsp Response (unit id + PDU)
+/// @param rsp_len Length of response
+/// @param writes c->writes when the read was sent, not stored if a write completed since (out-of-order target)
+void cache_store(struct cache* c, const uint8_t* req, int req_len, const uint8_t* rsp, int rsp_len, LONG64 writes);
+
+/// @brief Drop cached reads overlapping the range of a write request (0x05, 0x06, 0x0F, 0x10, 0x16, 0x17), count it in writes
+/// @param c Cache
+/// @param req Request (unit id + PDU), a broadcast (unit 0) drops the range of all units
+/// @param req_len Length of request
+void cache_invalidate(struct cache* c, const uint8_t* req, int req_len);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * File   : capture.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the always-on traffic capture. Writers
+ *               claim a ring record with one interlocked increment and
+ *               publish it with its sequence number, the dump thread copies
+ *               the records and skips the ones overwritten meanwhile. File
+ *               I/O happens in the dump thread only.
+ */
+
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+#include "cli.h"
+#include "config.h"
+#include "endian.h"
+
+#define CAPTURE_ERROR_INTERVAL_US   (60 * 1000000ULL)
+#define CAPTURE_POST_TRIGGER_MS     500     // Frames following the error go into the dump too
+#define PCAP_LINKTYPE_IPV4          228
+#define UNIX_EPOCH_US               11644473600000000ULL   // 1601-01-01 to 1970-01-01
+
+
+struct capture_record {
+    volatile LONG64 seq;            // Sequence number once complete, 0 while written
+    uint64_t time_us;               // time_us() when recorded
+    uint32_t conn;
+    uint16_t flags;                 // CAPTURE_*
+    uint16_t len;
+    uint8_t data[CAPTURE_SNAPLEN];
+};
+
+static struct capture_record* ring = NULL;
+static LONG64 ring_size = 0;                // Records, power of two
+static volatile LONG64 ring_head = 0;       // Records claimed so far
+static volatile LONG conn_ids = 0;
+static int64_t unix_offset_us;              // Unix time minus time_us()
+static char file_prefix[MAX_PATH];
+
+static CRITICAL_SECTION dump_lock;
+static HANDLE dump_event = NULL;
+static char dump_reason[100];               // Pending dump (dump_lock), empty if none
+static boolean dump_delayed;                // Error dump: wait for the frames following the error
+static volatile LONG64 error_dumped_us = 0;
+
+
+static DWORD WINAPI capture_thread(LPVOID lpParam);
+
+
+int capture_start() {
+    int frames = config()->capture_frames;
+    if (frames <= 0)
+        return 0;
+    for (ring_size = 1; ring_size < frames; ring_size <<= 1)
+        ;
+
+    // Relative to the executable, a service runs in the system directory
+    if (config()->capture_file[0]) {
+        strncpy(file_prefix, config()->capture_file, sizeof(file_prefix) -1);
+    } else {
+        DWORD len = GetModuleFileName(NULL, file_prefix, sizeof(file_prefix));
+        while (len > 0 && file_prefix[len -1] != '\\' && file_prefix[len -1] != '/')
+            len--;
+        snprintf(file_prefix + len, sizeof(file_prefix) - len, "capture");
+    }
+
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    uint64_t now_100ns = (uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime;
+    unix_offset_us = (int64_t)(now_100ns / 10 - UNIX_EPOCH_US) - (int64_t)time_us();
+
+    InitializeCriticalSection(&dump_lock);
+    dump_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    struct capture_record* records = calloc((size_t)ring_size, sizeof(struct capture_record));
+    if (!dump_event || !records || !CreateThread(NULL, 0, capture_thread, NULL, 0, NULL)) {
+        log_efln("Capture start failed: %s", GetLastErrorString(FALSE));
+        free(records);
+        return -1;
+    }
+    ring = records;
+    log_fln("Capturing the last %lld frames (%lld KB), dump with Ctrl+Break or service control %d to %s-*.pcap",
+        (long long)ring_size, (long long)(ring_size * sizeof(struct capture_record) / 1024), CAPTURE_SERVICE_CONTROL, file_prefix);
+    return 0;
+}
+
+uint32_t capture_conn_id() {
+    return (uint32_t)InterlockedIncrement(&conn_ids);
+}
+
+void capture_frame(uint32_t conn, int flags, const WSABUF* bufs, int count) {
+    if (!ring)
+        return;
+    LONG64 seq = InterlockedIncrement64(&ring_head);
+    struct capture_record* r = &ring[(seq -1) & (ring_size -1)];
+    InterlockedExchange64(&r->seq, 0);
+
+    r->time_us = time_us();
+    r->conn = conn;
+    r->flags = (uint16_t)flags;
+    int len = 0;
+    for (int i = 0; i < count && len < CAPTURE_SNAPLEN; i++) {
+        int part = (int)bufs[i].len < CAPTURE_SNAPLEN - len ? (int)bufs[i].len : CAPTURE_SNAPLEN - len;
+        memcpy(r->data + len, bufs[i].buf, part);
+        len += part;
+    }
+    r->len = (uint16_t)len;
+    InterlockedExchange64(&r->seq, seq);    // Publish
+}
+
+/// @brief Hand dump request to the dump thread
+static void capture_request(const char* reason, boolean delayed) {
+    if (!ring)
+        return;
+    EnterCriticalSection(&dump_lock);
+    if (!dump_reason[0]) {
+        strncpy(dump_reason, reason, sizeof(dump_reason) -1);
+        dump_delayed = delayed;
+    }
+    LeaveCriticalSection(&dump_lock);
+    SetEvent(dump_event);
+}
+
+void capture_dump(const char* reason) {
+    capture_request(reason, FALSE);
+}
+
+void capture_dump_error(const char* reason) {
+    uint64_t now = time_us();
+    LONG64 last = error_dumped_us;
+    if (!ring || (last && now - (uint64_t)last < CAPTURE_ERROR_INTERVAL_US))
+        return;
+    if (InterlockedCompareExchange64(&error_dumped_us, (LONG64)now, last) != last)
+        return;                 // Another thread reported the same desync
+    capture_request(reason, TRUE);
+}
+
+/// @brief Write record as IPv4/UDP packet: every connection has its own address,
+/// @brief the gateway is server of the master connections and client of the target connections
+static void capture_write_packet(FILE* f, const struct capture_record* r) {
+    boolean master = r->flags & CAPTURE_MASTER;
+    uint32_t peer = (master ? 0x0A010000 : 0x0A020000) | (r->conn & 0xFFFF);
+    uint16_t server_port = r->flags & CAPTURE_RTU ? CAPTURE_RTU_PORT : CAPTURE_MBAP_PORT;
+    uint16_t client_port = 49152 + (r->conn & 0x3FFF);
+    uint16_t gateway_port = master ? server_port : client_port;
+    uint16_t peer_port = master ? client_port : server_port;
+    boolean out = r->flags & CAPTURE_OUT;
+
+    uint8_t head[16 + 20 + 8];
+    uint64_t unix_us = (uint64_t)((int64_t)r->time_us + unix_offset_us);
+    uint32_t ip_len = 20 + 8 + r->len;
+    uint32_t pcap_head[4] = { (uint32_t)(unix_us / 1000000), (uint32_t)(unix_us % 1000000), ip_len, ip_len };
+    memcpy(head, pcap_head, sizeof(pcap_head));
+
+    uint8_t* ip = head +16;
+    memset(ip, 0, 20);
+    ip[0] = 0x45;                       // IPv4, 20 byte header
+    write_uint16_reverse(ip +2, (uint16_t)ip_len);
+    ip[8] = 64;                         // TTL
+    ip[9] = 17;                         // UDP
+    write_uint32_reverse(ip +12, out ? CAPTURE_GATEWAY_ADDRESS : peer);
+    write_uint32_reverse(ip +16, out ? peer : CAPTURE_GATEWAY_ADDRESS);
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2)
+        sum += read_uint16_reverse(ip + i);
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    write_uint16_reverse(ip +10, (uint16_t)~sum);
+
+    uint8_t* udp = ip +20;
+    write_uint16_reverse(udp, out ? gateway_port : peer_port);
+    write_uint16_reverse(udp +2, out ? peer_port : gateway_port);
+    write_uint16_reverse(udp +4, (uint16_t)(8 + r->len));
+    write_uint16_reverse(udp +6, 0);    // No checksum
+
+    fwrite(head, 1, sizeof(head), f);
+    fwrite(r->data, 1, r->len, f);
+}
+
+/// @brief Write all complete records of the ring to a new pcap file
+static void capture_write(const char* reason) {
+    char path[MAX_PATH + 32];
+    time_t now = time(NULL);
+    struct tm* tm = localtime(&now);
+    snprintf(path, sizeof(path), "%s-%04d%02d%02d-%02d%02d%02d.pcap", file_prefix,
+        tm->tm_year + 1900, tm->tm_mon +1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        log_efln("Capture: %s not writable (%s)", path, reason);
+        return;
+    }
+
+    // pcap file header, microsecond timestamps
+    uint32_t file_head[6] = { 0xA1B2C3D4, 2 | 4 << 16, 0, 0, CAPTURE_SNAPLEN + 28, PCAP_LINKTYPE_IPV4 };
+    fwrite(file_head, 1, sizeof(file_head), f);
+
+    LONG64 head = ring_head;
+    LONG64 first = head > ring_size ? head - ring_size +1 : 1;
+    struct capture_record* copy = malloc(sizeof(struct capture_record));
+    int written = 0;
+    for (LONG64 seq = first; copy && seq <= head; seq++) {
+        struct capture_record* r = &ring[(seq -1) & (ring_size -1)];
+        if (r->seq != seq)
+            continue;           // Still written or already overwritten
+        memcpy(copy, (const void*)r, sizeof(struct capture_record));
+        MemoryBarrier();
+        if (r->seq != seq)
+            continue;           // Overwritten while copied
+        capture_write_packet(f, copy);
+        written++;
+    }
+    free(copy);
+    fclose(f);
+    log_ifln("Capture: %d frames written to %s (%s)", written, path, reason);
+}
+
+static DWORD WINAPI capture_thread(LPVOID lpParam) {
+    while (!isStop()) {
+        if (WaitForSingleObject(dump_event, 1000) != WAIT_OBJECT_0)
+            continue;
+        if (dump_delayed)
+            Sleep(CAPTURE_POST_TRIGGER_MS);
+        char reason[sizeof(dump_reason)];
+        EnterCriticalSection(&dump_lock);
+        strcpy(reason, dump_reason);
+        dump_reason[0] = '\0';
+        LeaveCriticalSection(&dump_lock);
+        if (reason[0])
+            capture_write(reason);
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * File   : capture.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the always-on traffic capture. Every frame
+ *               received and sent on master and target connections goes
+ *               into a fixed-size in-memory ring, dumped on demand or on
+ *               desync errors as pcap file (IPv4/UDP, one address per
+ *               connection) that Wireshark decodes as Modbus.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "comm.h"
+
+#define CAPTURE_MASTER      0x01    // Frame on a master connection, else on a target connection
+#define CAPTURE_OUT         0x02    // Sent by the gateway, else received
+#define CAPTURE_RTU         0x04    // RTU framing (unit id, PDU, CRC), else MBAP
+
+#define CAPTURE_SNAPLEN     (MBAP_LEN + BUFFER_SIZE)
+
+#define CAPTURE_GATEWAY_ADDRESS 0x0A000001  // 10.0.0.1, masters 10.1.x.y, targets 10.2.x.y
+#define CAPTURE_MBAP_PORT   502     // Server port of Modbus TCP frames (Wireshark: Modbus/UDP)
+#define CAPTURE_RTU_PORT    5021    // Server port of RTU frames (Wireshark: Decode As... Modbus RTU)
+
+#define CAPTURE_SERVICE_CONTROL 128 // sc control ModbusProxyService 128 dumps the ring
+
+
+/// @brief Allocate the ring (--capture frames) and start the dump thread
+/// @return 0 if OK or disabled, <0 error
+int capture_start();
+
+/// @brief New connection id for capture_frame()
+/// @return Id, unique within the process
+uint32_t capture_conn_id();
+
+/// @brief Record one frame, never blocks; no-op if capturing is disabled
+/// @param conn Connection id (capture_conn_id)
+/// @param flags CAPTURE_*
+/// @param bufs Frame in parts (scatter/gather), truncated to CAPTURE_SNAPLEN
+/// @param count Number of parts
+void capture_frame(uint32_t conn, int flags, const WSABUF* bufs, int count);
+
+/// @brief Record one frame from a single buffer (see capture_frame)
+static inline void capture_bytes(uint32_t conn, int flags, const void* data, int len) {
+    WSABUF buf = { (ULONG)len, (char*)data };
+    capture_frame(conn, flags, &buf, 1);
+}
+
+/// @brief Dump the ring to a new pcap file (--capture-file), written by the dump thread
+/// @param reason Logged with the file name
+void capture_dump(const char* reason);
+
+/// @brief Dump the ring shortly after a desync error, at most once a minute
+/// @param reason Logged with the file name
+void capture_dump_error(const char* reason);
+
+#endif
@@ -1,18 +1,189 @@
-/*
- * File   : cli.c
- * Author : Thomas Mailaender
- * Date   : 2025-09-16
- *
- * Description : Implementation for console logging timestamps
- */
-
-#include <time.h>
-
-const char* getDTstr() {
-	static char strDt[32];
-    time_t t;
-    time(&t);
-	struct tm *gmt = gmtime(&t);
-	strftime(strDt, sizeof(strDt), "%Y-%m-%d %H:%M:%S", gmt);
-	return strDt;
-}
+/*
+ * File   : cli.c
+ * Author : Thomas Mailaender
+ * Date   : 2025-09-16
+ *
+ * Description : Implementation for console logging timestamps and the
+ *               asynchronous log writer. Every logging thread owns a
+ *               single-producer/single-consumer ring, the writer thread
+ *               merges the rings by time, adds the timestamp and prints.
+ *               Rings of finished threads are taken over by new ones.
+ */
+
+#include <time.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "cli.h"
+
+#define LOG_RING_SIZE   256     // Lines per thread, power of two
+#define LOG_LINE_SIZE   240     // Longer lines are truncated
+#define LOG_IDLE_MS     10      // Writer poll interval when all rings are empty
+
+
+struct log_record {
+    uint64_t time;              // FILETIME (100 ns since 1601, UTC)
+    int level;
+    char text[LOG_LINE_SIZE];
+};
+
+struct log_ring {
+    struct log_ring* next;
+    volatile LONG owned;        // 1 while a thread logs into it, 0 free for the next new thread
+    volatile LONG head;         // Written by the owning thread
+    volatile LONG tail;         // Written by the writer thread
+    struct log_record records[LOG_RING_SIZE];
+};
+
+static struct log_ring* volatile log_rings = NULL;
+static __declspec(thread) struct log_ring* log_ring_own = NULL;
+static DWORD log_fls = FLS_OUT_OF_INDEXES;     // Releases the ring when its thread exits
+static volatile LONG log_running = 0;
+static volatile LONG64 log_dropped_count = 0;
+static HANDLE log_thread = NULL;
+
+
+const char* getDTstr() {
+	static __declspec(thread) char strDt[32];
+    time_t t;
+    time(&t);
+	struct tm *gmt = gmtime(&t);
+	strftime(strDt, sizeof(strDt), "%Y-%m-%d %H:%M:%S", gmt);
+	return strDt;
+}
+
+/// @brief Thread exit: the ring goes to the next new thread, lines still queued in it are printed first
+static void NTAPI log_ring_release(PVOID data) {
+    struct log_ring* r = data;
+    if (r)
+        InterlockedExchange(&r->owned, 0);
+}
+
+/// @brief Ring of the calling thread, a released one or created and linked in on first use
+static struct log_ring* log_ring_get() {
+    if (!log_ring_own) {
+        // Continuing behind the head of a released ring keeps it single-producer
+        struct log_ring* r = log_rings;
+        while (r && (r->owned || InterlockedCompareExchange(&r->owned, 1, 0) != 0))
+            r = r->next;
+        if (!r) {
+            r = calloc(1, sizeof(struct log_ring));
+            if (!r)
+                return NULL;
+            r->owned = 1;
+            do {
+                r->next = log_rings;
+            } while (InterlockedCompareExchangePointer((PVOID volatile*)&log_rings, r, r->next) != r->next);
+        }
+        log_ring_own = r;
+        if (log_fls != FLS_OUT_OF_INDEXES)
+            FlsSetValue(log_fls, r);
+    }
+    return log_ring_own;
+}
+
+void log_write(int level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    if (!log_running) {
+        FILE* stream = level == LOG_LEVEL_ERROR ? stderr : stdout;
+        vfprintf(stream, format, args);
+        fputc('\n', stream);
+        va_end(args);
+        return;
+    }
+
+    struct log_ring* r = log_ring_get();
+    LONG head = r ? r->head : 0;
+    if (!r || head - r->tail >= LOG_RING_SIZE) {
+        InterlockedIncrement64(&log_dropped_count);     // Never block the caller
+        va_end(args);
+        return;
+    }
+    struct log_record* rec = &r->records[head & (LOG_RING_SIZE -1)];
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    rec->time = (uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime;
+    rec->level = level;
+    vsnprintf(rec->text, sizeof(rec->text), format, args);
+    va_end(args);
+    InterlockedExchange(&r->head, head +1);             // Publish record
+}
+
+/// @brief Print all queued lines, oldest first across all rings
+/// @return Number of printed lines
+static int log_drain() {
+    int count = 0;
+    for (;;) {
+        struct log_ring* oldest = NULL;
+        for (struct log_ring* r = log_rings; r; r = r->next) {
+            if (r->tail != r->head && (!oldest
+                    || r->records[r->tail & (LOG_RING_SIZE -1)].time < oldest->records[oldest->tail & (LOG_RING_SIZE -1)].time))
+                oldest = r;
+        }
+        if (!oldest)
+            break;
+
+        struct log_record* rec = &oldest->records[oldest->tail & (LOG_RING_SIZE -1)];
+        FILETIME ft = { (DWORD)rec->time, (DWORD)(rec->time >> 32) };
+        SYSTEMTIME st;
+        FileTimeToSystemTime(&ft, &st);
+        fprintf(rec->level == LOG_LEVEL_ERROR ? stderr : stdout, "%04u-%02u-%02u %02u:%02u:%02u.%03u %s\n",
+            st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds, rec->text);
+        InterlockedExchange(&oldest->tail, oldest->tail +1);   // Free record
+        count++;
+    }
+
+    static LONG64 dropped_reported = 0;
+    LONG64 dropped = log_dropped_count;
+    if (dropped != dropped_reported) {
+        fprintf(stderr, RED "%s %lld log lines dropped" COLOREND "\n", getDTstr(), (long long)(dropped - dropped_reported));
+        dropped_reported = dropped;
+    }
+    if (count) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return count;
+}
+
+static DWORD WINAPI log_writer(LPVOID lpParam) {
+    while (log_running) {
+        if (!log_drain())
+            Sleep(LOG_IDLE_MS);
+    }
+    log_drain();
+    return 0;
+}
+
+int log_start() {
+    if (log_running)
+        return 0;
+    if (log_fls == FLS_OUT_OF_INDEXES)
+        log_fls = FlsAlloc(log_ring_release);
+    log_running = 1;
+    log_thread = CreateThread(NULL, 0, log_writer, NULL, 0, NULL);
+    if (!log_thread) {
+        log_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void log_stop() {
+    if (!log_running)
+        return;
+    log_running = 0;
+    WaitForSingleObject(log_thread, INFINITE);
+    CloseHandle(log_thread);
+    log_thread = NULL;
+    log_drain();                // Lines queued after the writer's last round
+}
+
+long long log_dropped() {
+    return log_dropped_count;
+}
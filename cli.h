@@ -1,83 +1,131 @@
-/*
- * File   : cli.h
- * Author : Thomas Mailaender
- * Date   : 2025-09-16
- *
- * Description : Definitions for simple colorized console logging
- */
-
-#ifndef __CLI_H__
-#define __CLI_H__
-
-#include <stddef.h>
-#include <stdio.h>
-
-  //#define LF  0x0A
-  //#define CR  0x0D
-	//#define ESC	0x1B
-
-  enum ASCII_Key {
-    BS  = 0x08,
-    LF  = 0x0A,
-    CR  = 0x0D,
-    ESC = 0x1B,
-    DEL = 0x7F
-  };
-
-
-	// ANSI Escape SEQUENZEN  für Farbausgabe in Serial Terminal see https://stackoverflow.com/questions/4842424/list-of-ansi-color-escape-sequences
-
-	//#define RED		"\e[1;31m"	// So werden fette kraeftife Farben angezeigt (1; = BOLD)
-	#define BOLD		"\e[1m"
-	#define UNDERLINE	"\e[4m"
-	// RESET all attributes
-	#define COLOREND	"\e[0m"
-	// Foreground Colors
-	#define DARKGRAY	"\e[30m"
-	#define RED			"\e[31m"
-	#define GREEN		"\e[32m"
-	#define YELLOW		"\e[33m"
-	#define BLUE		"\e[34m"
-	#define MAGENTA		"\e[35m"
-	#define CYAN		"\e[36m"
-	#define WHITE		"\e[37m"
-	// Background colors
-	#define BG_DARKGRAY	"\e[40m"
-	#define BG_RED		"\e[41m"
-	#define BG_GREEN	"\e[42m"
-	#define BG_YELLOW	"\e[43m"
-	#define BG_BLUE		"\e[44m"
-	#define BG_MAGENTA	"\e[45m"
-	#define BG_CYAN		"\e[46m"
-	#define BG_WHITE	"\e[47m"
-
-
-	#define log(...)		print(__VA_ARGS__)
-	#define log_s(txt)		print(GREEN txt COLOREND)
-	#define log_i(txt)		print(CYAN txt COLOREND)
-	#define log_w(txt)		print(YELLOW txt COLOREND)
-	#define log_e(txt)		fprint(stderr, RED txt COLOREND)
-
-	#define log_ln(...)		printf(__VA_ARGS__ "\n")
-	#define log_sln(txt)	printf(GREEN txt COLOREND "\n")
-	#define log_iln(txt)	printf(CYAN txt COLOREND "\n")
-	#define log_wln(txt)	printf(YELLOW txt COLOREND "\n")
-	#define log_eln(txt)	fprintf(stderr, RED txt COLOREND "\n")
-
-	#define log_f(...)				printf(__VA_ARGS__)
-	#define log_sf(format, ...)		printf(GREEN format COLOREND, __VA_ARGS__)
-	#define log_if(format, ...)		printf(CYAN format COLOREND, __VA_ARGS__)
-	#define log_wf(format, ...)		printf(YELLOW format COLOREND, __VA_ARGS__)
-	#define log_ef(format, ...)		fprintf(stderr, RED format COLOREND, __VA_ARGS__)
-
-	#define log_fln(format, ...)	printf(format "\n", __VA_ARGS__)
-	#define log_sfln(format, ...)	printf(GREEN format COLOREND "\n", __VA_ARGS__)
-	#define log_ifln(format, ...)	printf(CYAN format COLOREND "\n", __VA_ARGS__)
-	#define log_wfln(format, ...)	printf(YELLOW format COLOREND "\n", __VA_ARGS__)
-	#define log_efln(format, ...)	fprintf(stderr, RED format COLOREND "\n", __VA_ARGS__)
-
-	const char* getDTstr();
-	//const char* txtMilliSec(uint64_t millisec);
-	//const char* timeMilliSec(uint64_t millisec);
-
-#endif
+/*
+ * File   : cli.h
+ * Author : Thomas Mailaender
+ * Date   : 2025-09-16
+ *
+ * Description : Definitions for simple colorized console logging.
+ *               The *ln macros are asynchronous: the calling thread only
+ *               formats into its own ring buffer, a writer thread adds the
+ *               timestamp and does the console I/O.
+ */
+
+#ifndef __CLI_H__
+#define __CLI_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+  //#define LF  0x0A
+  //#define CR  0x0D
+	//#define ESC	0x1B
+
+  enum ASCII_Key {
+    BS  = 0x08,
+    LF  = 0x0A,
+    CR  = 0x0D,
+    ESC = 0x1B,
+    DEL = 0x7F
+  };
+
+
+	// ANSI Escape SEQUENZEN  für Farbausgabe in Serial Terminal see https://stackoverflow.com/questions/4842424/list-of-ansi-color-escape-sequences
+
+	//#define RED		"\e[1;31m"	// So werden fette kraeftife Farben angezeigt (1; = BOLD)
+	#define BOLD		"\e[1m"
+	#define UNDERLINE	"\e[4m"
+	// RESET all attributes
+	#define COLOREND	"\e[0m"
+	// Foreground Colors
+	#define DARKGRAY	"\e[30m"
+	#define RED			"\e[31m"
+	#define GREEN		"\e[32m"
+	#define YELLOW		"\e[33m"
+	#define BLUE		"\e[34m"
+	#define MAGENTA		"\e[35m"
+	#define CYAN		"\e[36m"
+	#define WHITE		"\e[37m"
+	// Background colors
+	#define BG_DARKGRAY	"\e[40m"
+	#define BG_RED		"\e[41m"
+	#define BG_GREEN	"\e[42m"
+	#define BG_YELLOW	"\e[43m"
+	#define BG_BLUE		"\e[44m"
+	#define BG_MAGENTA	"\e[45m"
+	#define BG_CYAN		"\e[46m"
+	#define BG_WHITE	"\e[47m"
+
+
+	#define log(...)		print(__VA_ARGS__)
+	#define log_s(txt)		print(GREEN txt COLOREND)
+	#define log_i(txt)		print(CYAN txt COLOREND)
+	#define log_w(txt)		print(YELLOW txt COLOREND)
+	#define log_e(txt)		fprint(stderr, RED txt COLOREND)
+
+	// Log levels, LOG_LEVEL removes the macros above it at compile time
+	#define LOG_LEVEL_OUTPUT	0	// Plain log_ln/log_fln: program output, always kept
+	#define LOG_LEVEL_ERROR		1
+	#define LOG_LEVEL_WARN		2
+	#define LOG_LEVEL_INFO		3	// log_s*, log_i*
+	#ifndef LOG_LEVEL
+	#define LOG_LEVEL			LOG_LEVEL_INFO
+	#endif
+
+	#define log_ln(...)		log_write(LOG_LEVEL_OUTPUT, __VA_ARGS__)
+	#define log_fln(format, ...)	log_write(LOG_LEVEL_OUTPUT, format, __VA_ARGS__)
+	#if LOG_LEVEL >= LOG_LEVEL_INFO
+	#define log_sln(txt)	log_write(LOG_LEVEL_INFO, GREEN txt COLOREND)
+	#define log_iln(txt)	log_write(LOG_LEVEL_INFO, CYAN txt COLOREND)
+	#define log_sfln(format, ...)	log_write(LOG_LEVEL_INFO, GREEN format COLOREND, __VA_ARGS__)
+	#define log_ifln(format, ...)	log_write(LOG_LEVEL_INFO, CYAN format COLOREND, __VA_ARGS__)
+	#else
+	#define log_sln(txt)	((void)0)
+	#define log_iln(txt)	((void)0)
+	#define log_sfln(format, ...)	((void)0)
+	#define log_ifln(format, ...)	((void)0)
+	#endif
+	#if LOG_LEVEL >= LOG_LEVEL_WARN
+	#define log_wln(txt)	log_write(LOG_LEVEL_WARN, YELLOW txt COLOREND)
+	#define log_wfln(format, ...)	log_write(LOG_LEVEL_WARN, YELLOW format COLOREND, __VA_ARGS__)
+	#else
+	#define log_wln(txt)	((void)0)
+	#define log_wfln(format, ...)	((void)0)
+	#endif
+	#if LOG_LEVEL >= LOG_LEVEL_ERROR
+	#define log_eln(txt)	log_write(LOG_LEVEL_ERROR, RED txt COLOREND)
+	#define log_efln(format, ...)	log_write(LOG_LEVEL_ERROR, RED format COLOREND, __VA_ARGS__)
+	#else
+	#define log_eln(txt)	((void)0)
+	#define log_efln(format, ...)	((void)0)
+	#endif
+
+	#define log_f(...)				printf(__VA_ARGS__)
+	#define log_sf(format, ...)		printf(GREEN format COLOREND, __VA_ARGS__)
+	#define log_if(format, ...)		printf(CYAN format COLOREND, __VA_ARGS__)
+	#define log_wf(format, ...)		printf(YELLOW format COLOREND, __VA_ARGS__)
+	#define log_ef(format, ...)		fprintf(stderr, RED format COLOREND, __VA_ARGS__)
+
+	/// @brief Queue one log line (newline is added), never blocks:
+	/// @brief drops the line and counts it if the ring of the calling thread is full.
+	/// @brief Before log_start() and after log_stop() the line is printed directly.
+	/// @param level LOG_LEVEL_*, errors go to stderr
+	/// @param format printf format
+	void log_write(int level, const char* format, ...);
+
+	/// @brief Start the writer thread, from now on logging is asynchronous
+	/// @return 0 if OK, <0 error (logging stays synchronous)
+	int log_start();
+
+	/// @brief Write all queued lines and stop the writer thread
+	void log_stop();
+
+	/// @brief Number of dropped log lines
+	/// @return Count since start
+	long long log_dropped();
+
+	/// @brief Current UTC date and time as text (buffer per thread)
+	/// @return "YYYY-MM-DD hh:mm:ss"
+	const char* getDTstr();
+	//const char* txtMilliSec(uint64_t millisec);
+	//const char* timeMilliSec(uint64_t millisec);
+
+#endif
@@ -1,113 +1,181 @@
-/*
- * File   : comm.h
- * Author : Thomas Mailaender
- * Date   : 2025-09-16
- *
- * Description : Prototypes for common communication
- *               functions to realize a gateway between
- *               Modbus TCP ↔ Modbus RTU over TCP
- */
-
-#ifndef __COMM_H__
-#define __COMM_H__
-
-#include <stdint.h>
-#include <winsock2.h>
-
-
-enum enSIMPLE_TCP {
-    enSIMPLE_TCP_disconnected = 0,
-    enSIMPLE_TCP_error_timeout = -1,
-    enSIMPLE_TCP_aborted = -10,
-    enSIMPLE_TCP_error_tooMuchData = -11,
-    enSIMPLE_TCP_error_bufferFull = -12,
-    enSIMPLE_TCP_error_crc = -13
-};
-
-
-/// @brief Handle new connected socket from Master as TCP,
-/// @brief does the logic in a blocking mode waiting for data
-/// @param master Accepted Socket (Master as TCP)
-void handleSocket_TCP2RTU(SOCKET master);
-
-/// @brief Handle new connected socket from Master as RTU,
-/// @brief does the logic in a blocking mode waiting for data
-/// @param master Accepted Socket (Master as RTU)
-void handleSocket_RTU2TCP(SOCKET master);
-
-
-
-/// @brief Get simpleTcpInfoStr for error code
-/// @param val Returncode Error code (see enSIMPLE_TCP)
-/// @param name Name to identify (e.g. "Master" or "Slave")
-/// @return Error string or NULL if no error
-const char* simpleTcpInfoStr(int val, char* name);
-
-/// @brief Get errno as string
-/// @return Error string
-const char* ERRNOGetLastErrorString();
-
-/// @brief Get WSAGetLastError as string
-/// @return Error string
-const char* WSAGetLastErrorString();
-
-/// @brief Get combined error string of errno and WSAGetLastError
-/// @param hideNoError If true and no error, return empty string
-/// @return Error string
-const char* GetLastErrorString(boolean hideNoError);
-
-
-
-/// @brief Receive Modbus TCP (MBAP) packet from Master
-/// @param client Socket to Master
-/// @param buffer Buffer to store data
-/// @param size Buffer size
-/// @return >0 Length of received data, 0 disconnected, <0 error (see enSIMPLE_TCP)
-int recv_mbap(SOCKET client, void* buffer, size_t size);
-
-
-/// @brief Receive Modbus RTU packet from Slave
-/// @param client Socket to Slave
-/// @param buffer Buffer to store data
-/// @param size Buffer size
-/// @param expected_pdu_len Expected length of PDU (without adress and CRC), -1 if unknown
-/// @return >0 Length of received data, 0 disconnected, <0 error (see enSIMPLE_TCP)
-int recv_rtu(SOCKET client, void* buffer, size_t size, int expected_pdu_len);
-
-
-/// @brief Send all data in buffer
-/// @param sockfd Socket
-/// @param buffer Data buffer
-/// @param length Length of data
-/// @return Number of sent bytes, 0 disconnected, <0 error (see enSIMPLE_TCP)
-size_t send_all(int sockfd, const void *buffer, size_t length);
-
-
-
-/// @brief In case of unknown data to protect a bit against desync: clear input
-/// @param sockfd Socket
-/// @return amount of garbaged data
-int clear_socket_in_buffer(int sockfd);
-
-
-/// @brief Checks whether data is available
-/// @param sockfd Socket
-/// @return -1 Error, 0 No data available, >=1 Data available
-int socket_data_available(int sockfd);
-
-
-/// @brief Set TCP KeepAlive on socket (and setting lower values)
-/// @param sockfd Socket
-/// @param val TRUE to enable, FALSE to disable
-/// @return 0 if OK, <0 error (see enSIMPLE_TCP)
-int setSocketKeepAlive(int sockfd, BOOL val);
-
-
-
-/// @brief Calculate expected Length of PDU-response (without adress and CRC)
-/// @param function_code Modbus Function code
-/// @param quantity Quantity of registers (not bytes)
-/// @return Expected length of PDU in bytes (without adress and CRC), -1 if unknown function code
-int expected_pdu_length(uint8_t function_code, uint16_t quantity);
-
+/*
+ * File   : comm.h
+ * Author : Thomas Mailaender
+ * Date   : 2025-09-16
+ *
+ * Description : Prototypes for common communication
+ *               functions to realize a gateway between
+ *               Modbus TCP ↔ Modbus RTU over TCP
+ */
+
+#ifndef __COMM_H__
+#define __COMM_H__
+
+#include <stdint.h>
+#include <winsock2.h>
+
+
+#define RTU_TIMEOUT 500
+#define TCP_TIMEOUT 3000
+
+#define BUFFER_SIZE 260
+#define MAX_ERR_LEN 300
+
+#define MBAP_LEN    6
+#define RTU_MIN_LEN 6
+#define TCP_MIN_LEN 6
+#define RTU_ERR_LEN 5
+
+// Modbus exception codes used by the gateway itself
+#define MODBUS_EXC_GATEWAY_PATH         0x0A
+#define MODBUS_EXC_GATEWAY_NO_RESPONSE  0x0B
+
+#define MODBUS_BROADCAST_UNIT   0       // Requests to unit 0 go to all slaves, none of them responds
+
+struct rtu_stream;
+
+/// @brief Copy and syscall counters of the data path, to measure the cost per transaction
+struct io_counters {
+    volatile LONG64 bytes_copied;       // Frame bytes moved between buffers
+    volatile LONG64 syscalls;           // send/recv calls on master and target sockets
+    volatile LONG64 transactions;       // Transactions submitted to targets
+};
+extern struct io_counters io_counters;
+
+static inline void io_count_copy(int bytes) { InterlockedExchangeAdd64(&io_counters.bytes_copied, bytes); }
+static inline void io_count_syscall() { InterlockedIncrement64(&io_counters.syscalls); }
+
+enum enSIMPLE_TCP {
+    enSIMPLE_TCP_disconnected = 0,
+    enSIMPLE_TCP_error_timeout = -1,
+    enSIMPLE_TCP_aborted = -10,
+    enSIMPLE_TCP_error_tooMuchData = -11,
+    enSIMPLE_TCP_error_bufferFull = -12,
+    enSIMPLE_TCP_error_crc = -13,
+    enSIMPLE_TCP_dropped = -14,            // Not sent, master gave up while it was queued
+    enSIMPLE_TCP_broadcast = -15           // Broadcast sent, no response by specification (no error)
+};
+
+
+/// @brief Get simpleTcpInfoStr for error code
+/// @param val Returncode Error code (see enSIMPLE_TCP)
+/// @param name Name to identify (e.g. "Master" or "Slave")
+/// @return Error string or NULL if no error
+const char* simpleTcpInfoStr(int val, char* name);
+
+/// @brief Get errno as string
+/// @return Error string
+const char* ERRNOGetLastErrorString();
+
+/// @brief Get WSAGetLastError as string
+/// @return Error string
+const char* WSAGetLastErrorString();
+
+/// @brief Get combined error string of errno and WSAGetLastError
+/// @param hideNoError If true and no error, return empty string
+/// @return Error string
+const char* GetLastErrorString(boolean hideNoError);
+
+
+
+/// @brief Receive Modbus TCP (MBAP) packet from Master
+/// @param client Socket to Master
+/// @param buffer Buffer to store data
+/// @param size Buffer size
+/// @return >0 Length of received data, 0 disconnected, <0 error (see enSIMPLE_TCP)
+int recv_mbap(SOCKET client, void* buffer, size_t size);
+
+
+/// @brief Receive Modbus RTU packet from Slave, exactly one frame per call
+/// @param client Socket to Slave
+/// @param stream Receive state of the connection, keeps bytes of the next frame
+/// @param buffer Buffer to store the frame (RTU_MAX_LEN)
+/// @return >0 Length of frame including CRC (checked), 0 disconnected, <0 error (see enSIMPLE_TCP)
+int recv_rtu(SOCKET client, struct rtu_stream* stream, void* buffer);
+
+
+/// @brief Send all data in buffer
+/// @param sockfd Socket
+/// @param buffer Data buffer
+/// @param length Length of data
+/// @return Number of sent bytes, 0 disconnected, <0 error (see enSIMPLE_TCP)
+int send_all(int sockfd, const void *buffer, size_t length);
+
+
+
+/// @brief Send scattered buffers (e.g. MBAP header + PDU or PDU + CRC) with one WSASend,
+/// @brief more calls only if the socket takes less
+/// @param sock Socket
+/// @param bufs Buffers, modified (consumed) while sending
+/// @param count Number of buffers
+/// @return Number of sent bytes, 0 disconnected, <0 error (see enSIMPLE_TCP)
+int send_gather(SOCKET sock, WSABUF* bufs, int count);
+
+/// @brief Drop sent bytes from the front of a scatter/gather list
+/// @param bufs Buffers
+/// @param count Number of buffers
+/// @param sent Number of sent bytes
+/// @return Number of buffers left
+int wsabuf_consume(WSABUF* bufs, int count, int sent);
+
+
+/// @brief In case of unknown data to protect a bit against desync: clear input
+/// @param sockfd Socket
+/// @return amount of garbaged data
+int clear_socket_in_buffer(int sockfd);
+
+
+/// @brief Checks whether data is available
+/// @param sockfd Socket
+/// @return -1 Error, 0 No data available, >=1 Data available
+int socket_data_available(int sockfd);
+
+
+/// @brief Set TCP KeepAlive on socket (and setting lower values)
+/// @param sockfd Socket
+/// @param val TRUE to enable, FALSE to disable
+/// @return 0 if OK, <0 error (see enSIMPLE_TCP)
+int setSocketKeepAlive(int sockfd, BOOL val);
+
+
+
+/// @brief Build exception response (unit id + PDU) for request
+/// @param rsp Buffer for response (at least 3 bytes)
+/// @param req Request (unit id + PDU)
+/// @param code Exception code
+/// @return Length of response
+int build_exception(uint8_t* rsp, const uint8_t* req, uint8_t code);
+
+/// @brief Monotonic timestamp
+/// @return Microseconds since undefined start point
+uint64_t time_us();
+
+/// @brief Wait with sub-millisecond precision: Sleep() for the bulk, spin for the rest
+/// @brief Sleep() has millisecond resolution only after timeBeginPeriod(1)
+/// @param us Microseconds
+void wait_us(uint64_t us);
+
+
+/// @brief Calculate expected Length of PDU-response (without adress and CRC)
+/// @param function_code Modbus Function code
+/// @param quantity Quantity of registers (not bytes)
+/// @return Expected length of PDU in bytes (without adress and CRC), -1 if unknown function code
+int expected_pdu_length(uint8_t function_code, uint16_t quantity);
+
+/// @brief Maximum quantity of a read request, limited by the Modbus PDU and BUFFER_SIZE
+/// @param function_code Modbus Function code
+/// @return Maximum quantity (coils or registers), 0 if not a read function code (0x01-0x04)
+int read_max_quantity(uint8_t function_code);
+
+/// @brief Build response for a read request out of the response to a covering read
+/// @param req Read request (unit id + PDU), its range must lie within the covering one
+/// @param covering_rsp Response to the covering read (unit id + PDU)
+/// @param covering_rsp_len Length of covering response
+/// @param covering_address Start address of covering read
+/// @param covering_quantity Quantity of covering read
+/// @param rsp Buffer for the response (BUFFER_SIZE)
+/// @return >0 Length of response, <0 covering response invalid (see enSIMPLE_TCP)
+int slice_read_response(const uint8_t* req, const uint8_t* covering_rsp, int covering_rsp_len,
+                        uint16_t covering_address, uint16_t covering_quantity, uint8_t* rsp);
+
 #endif
\ No newline at end of file
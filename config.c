@@ -0,0 +1,634 @@
+/*
+ * File   : config.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation for the settings of the gateway. Options
+ *               are parsed into a new snapshot, published with one pointer
+ *               exchange. Replaced snapshots are freed once every reader
+ *               thread has passed a quiescent point (epoch acknowledged),
+ *               readers never lock.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "cli.h"
+#include "comm.h"
+
+#define CONFIG_LINE_LEN     1024
+
+
+static const struct config defaults = {
+    .listen_port = 1502,
+    .target_host = "127.0.0.1",
+    .target_port = 502,
+    .cache_ttl_ms = 0,
+    .coalesce = 1,
+    .window = 1,
+    .prewarm = 1,
+    .broadcast_delay_ms = 100,
+    .capture_frames = 8192,
+    .backlog = 512,
+};
+
+#define READER_FREE     0       // Slot of reader_epochs not taken
+#define READER_OFFLINE  (-1)    // Reader blocked outside any snapshot, does not hold back freeing
+
+
+/// @brief Replaced snapshot waiting for the readers
+struct retired {
+    struct retired* next;
+    struct config* snapshot;
+    LONG64 epoch;               // Freed once every online reader has acknowledged this epoch
+};
+
+static struct config* volatile current = NULL;  // Published snapshot
+static volatile LONG64 epoch = 1;               // Incremented with every swap
+static volatile LONG64 reader_epochs[CONFIG_MAX_READERS];  // Epoch at the last quiescent point of each reader
+static volatile LONG untracked_readers = 0;     // Readers without slot, nothing is freed while there are any
+static struct retired* retired = NULL;          // Replaced snapshots, oldest last (reloading thread only)
+static struct config* cfg;                      // Snapshot under construction
+
+static char** args;                             // Command line, replayed by config_reload()
+static int arg_count;
+static char config_file[MAX_PATH];              // --config, empty if none
+static int positional;                          // Positional arguments seen so far
+
+
+const struct config* config() { return current; }
+
+
+/// @brief --cache-ttl=<ms> | <unit>:<ms> | <unit>:<function code>:<ms>
+static int option_cache_ttl(const char* value) {
+    int a, b, c;
+    int n = sscanf(value, "%i:%i:%i", &a, &b, &c);
+    if (n == 1 && a >= 0) {
+        cfg->cache_ttl_ms = a;
+        return 0;
+    }
+    if (cfg->cache_rule_count >= CONFIG_MAX_RULES)
+        return -1;
+    struct cache_rule* rule = &cfg->cache_rules[cfg->cache_rule_count];
+    if (n == 2 && a >= 0 && a <= 255 && b >= 0) {
+        *rule = (struct cache_rule){ a, -1, b };
+    } else if (n == 3 && a >= 0 && a <= 255 && b >= 0x01 && b <= 0x04 && c >= 0) {
+        *rule = (struct cache_rule){ a, b, c };
+    } else {
+        return -1;
+    }
+    cfg->cache_rule_count++;
+    return 0;
+}
+
+/// @brief --max-quantity=<quantity> | <unit>[-<unit>]:<quantity> | <unit>[-<unit>]:<function code>:<quantity>
+static int option_max_quantity(const char* value) {
+    int n = -1, quantity;
+    if (sscanf(value, "%i%n", &quantity, &n) == 1 && !value[n]) {
+        if (quantity < 0 || quantity > 2000)
+            return -1;
+        cfg->max_quantity = quantity;   // Only a plain N, UNIT:... rules start with a number as well
+        return 0;
+    }
+    if (cfg->quantity_rule_count >= CONFIG_MAX_RULES)
+        return -1;
+    struct quantity_rule* rule = &cfg->quantity_rules[cfg->quantity_rule_count];
+    n = -1;
+    if (sscanf(value, "%i-%i:%n", &rule->unit_first, &rule->unit_last, &n) == 2 && n >= 0) {
+        value += n;
+    } else if (sscanf(value, "%i:%n", &rule->unit_first, &n) == 1 && n >= 0) {
+        rule->unit_last = rule->unit_first;
+        value += n;
+    } else {
+        return -1;
+    }
+    n = -1;
+    if (sscanf(value, "%i:%i%n", &rule->function_code, &rule->quantity, &n) != 2 || value[n]) {
+        rule->function_code = 0;
+        n = -1;
+        if (sscanf(value, "%i%n", &rule->quantity, &n) != 1 || value[n])
+            return -1;
+    }
+    if (rule->unit_first < 0 || rule->unit_first > rule->unit_last || rule->unit_last > 255
+            || rule->function_code < 0 || rule->function_code > 0x04 || rule->quantity < 1 || rule->quantity > 2000)
+        return -1;
+    cfg->quantity_rule_count++;
+    return 0;
+}
+
+/// @brief --route=<unit>[-<unit>]=<host>:<port>
+static int option_route(const char* value) {
+    if (cfg->route_count >= CONFIG_MAX_ROUTES)
+        return -1;
+    struct route_rule* rule = &cfg->routes[cfg->route_count];
+    int n = -1;
+    if (sscanf(value, "%i-%i=%255[^:]:%i%n", &rule->unit_first, &rule->unit_last, rule->host, &rule->port, &n) != 4) {
+        if (sscanf(value, "%i=%255[^:]:%i%n", &rule->unit_first, rule->host, &rule->port, &n) != 3)
+            return -1;
+        rule->unit_last = rule->unit_first;
+    }
+    if (value[n] || rule->unit_first < 0 || rule->unit_first > rule->unit_last || rule->unit_last > 255
+            || rule->port < 1 || rule->port > 65535)
+        return -1;
+    cfg->route_count++;
+    return 0;
+}
+
+/// @brief --poll=<unit>:<function code>:<address>:<quantity>:<interval ms>
+static int option_poll(const char* value) {
+    if (cfg->poll_count >= CONFIG_MAX_POLLS)
+        return -1;
+    struct poll_rule* rule = &cfg->polls[cfg->poll_count];
+    int n = -1;
+    if (sscanf(value, "%i:%i:%i:%i:%i%n", &rule->unit, &rule->function_code, &rule->address, &rule->quantity,
+            &rule->interval_ms, &n) != 5 || value[n])
+        return -1;
+    if (rule->unit < 0 || rule->unit > 255 || rule->function_code < 0x01 || rule->function_code > 0x04
+            || rule->address < 0 || rule->quantity < 1 || rule->address + rule->quantity > 65536
+            || rule->interval_ms < 10)
+        return -1;
+    cfg->poll_count++;
+    return 0;
+}
+
+/// @brief 0|1
+static int option_bool(const char* value, int* option) {
+    if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0)
+        return -1;
+    *option = value[0] == '1';
+    return 0;
+}
+
+/// @brief Integer in [min, max]
+static int option_int(const char* value, int min, int max, int* option) {
+    char* end;
+    long v = strtol(value, &end, 0);
+    if (end == value || *end || v < min || v > max)
+        return -1;
+    *option = (int)v;
+    return 0;
+}
+
+/// @brief --timeout=auto|unit|<ms>
+static int option_timeout(const char* value) {
+    cfg->timeout_per_unit = strcmp(value, "unit") == 0;
+    if (strcmp(value, "auto") == 0 || cfg->timeout_per_unit) {
+        cfg->timeout_ms = 0;
+        return 0;
+    }
+    return option_int(value, 1, 600000, &cfg->timeout_ms);
+}
+
+/// @brief --capture-file=<path prefix>
+static int option_capture_file(const char* value) {
+    if (!value[0] || strlen(value) >= sizeof(cfg->capture_file))
+        return -1;
+    strcpy(cfg->capture_file, value);
+    return 0;
+}
+
+/// @brief --image-shm=<name>
+static int option_image_shm(const char* value) {
+    if (strlen(value) >= sizeof(cfg->image_shm) || strchr(value, '\\'))
+        return -1;
+    strcpy(cfg->image_shm, value);
+    return 0;
+}
+
+/// @brief --priority=<address>[/<bits>]=<class>[:<weight>] | <port>=<class>[:<weight>]
+static int option_priority(const char* value) {
+    if (cfg->priority_count >= CONFIG_MAX_PRIORITIES)
+        return -1;
+    struct priority_rule* rule = &cfg->priorities[cfg->priority_count];
+    unsigned a, b, c, d;
+    int bits = 32;
+    int n = -1;
+    if (sscanf(value, "%u.%u.%u.%u%n", &a, &b, &c, &d, &n) == 4) {
+        if (a > 255 || b > 255 || c > 255 || d > 255)
+            return -1;
+        value += n;
+        n = -1;
+        if (*value == '/' && (sscanf(value, "/%i%n", &bits, &n) != 1 || bits < 0 || bits > 32))
+            return -1;
+        if (*value == '/')
+            value += n;
+        rule->mask = bits ? 0xFFFFFFFFu << (32 - bits) : 0;
+        rule->address = (a << 24 | b << 16 | c << 8 | d) & rule->mask;
+        rule->port = 0;
+    } else {
+        if (sscanf(value, "%i%n", &rule->port, &n) != 1 || rule->port < 1 || rule->port > 65535)
+            return -1;
+        value += n;
+        rule->address = rule->mask = 0;
+    }
+
+    rule->weight = 1;
+    n = -1;
+    if (sscanf(value, "=%i%n", &rule->priority, &n) != 1)
+        return -1;
+    value += n;
+    n = -1;
+    if (*value == ':' && sscanf(value, ":%i%n", &rule->weight, &n) == 1)
+        value += n;
+    if (*value || rule->priority < 0 || rule->priority >= CONFIG_PRIORITY_CLASSES
+            || rule->weight < 1 || rule->weight > 100)
+        return -1;
+    cfg->priority_count++;
+    return 0;
+}
+
+/// @brief --baud=[<host>:<port>=]<baud>[:<data bits><parity N|E|O><stop bits>], e.g. 9600:8N1
+static int option_baud(const char* value) {
+    if (cfg->bus_count >= CONFIG_MAX_BUSES)
+        return -1;
+    struct bus_rule* rule = &cfg->buses[cfg->bus_count];
+    int n = -1;
+    rule->host[0] = '\0';
+    rule->port = 0;
+    if (strchr(value, '=')) {
+        if (sscanf(value, "%255[^:]:%i=%n", rule->host, &rule->port, &n) != 2 || n < 0
+                || rule->port < 1 || rule->port > 65535)
+            return -1;
+        value += n;
+    }
+    n = -1;
+    if (sscanf(value, "%i%n", &rule->baud, &n) != 1 || rule->baud < 0 || rule->baud > 4000000)
+        return -1;
+    value += n;
+    rule->char_bits = 11;       // Modbus RTU default 8E1
+    if (*value == ':') {
+        int data, stop;
+        char parity;
+        n = -1;
+        if (sscanf(value, ":%1d%c%1d%n", &data, &parity, &stop, &n) != 3 || value[n]
+                || data < 5 || data > 8 || !strchr("NEO", parity) || stop < 1 || stop > 2)
+            return -1;
+        rule->char_bits = 1 + data + (parity != 'N') + stop;
+    } else if (*value) {
+        return -1;
+    }
+    cfg->bus_count++;
+    return 0;
+}
+
+/// @brief --listen=<port>
+static int option_listen(const char* value) {
+    if (cfg->listen_count >= CONFIG_MAX_LISTENERS
+            || option_int(value, 1, 65535, &cfg->listen_ports[cfg->listen_count]))
+        return -1;
+    cfg->listen_count++;
+    return 0;
+}
+
+/// @brief --mode=tcp|rtu (positional 1)
+static int option_mode(const char* value) {
+    if (strcmp(value, "tcp") != 0 && strcmp(value, "rtu") != 0)
+        return -1;
+    cfg->rtu = strcmp(value, "rtu") == 0;
+    return 0;
+}
+
+/// @brief --target=<host>:<port> (positional 3 and 4)
+static int option_target(const char* value) {
+    int n = -1;
+    if (sscanf(value, "%255[^:]:%i%n", cfg->target_host, &cfg->target_port, &n) != 2 || value[n]
+            || cfg->target_port < 1 || cfg->target_port > 65535)
+        return -1;
+    return 0;
+}
+
+static int config_option(const char* arg);
+
+/// @brief --config=<file>: one key=value per line (keys of the options), # comments
+static int option_config(const char* value) {
+    if (config_file[0] && strcmp(config_file, value) != 0)
+        return -1;                  // One file, it may not include others
+    if (!value[0] || strlen(value) >= sizeof(config_file))
+        return -1;
+    strcpy(config_file, value);
+
+    FILE* f = fopen(config_file, "r");
+    if (!f) {
+        log_efln("Config file %s not readable", config_file);
+        return -1;
+    }
+    char line[CONFIG_LINE_LEN];
+    char option[CONFIG_LINE_LEN + 2];
+    int result = 0;
+    for (int number = 1; fgets(line, sizeof(line), f); number++) {
+        char* key = line;
+        while (*key == ' ' || *key == '\t')
+            key++;
+        char* end = key + strlen(key);
+        while (end > key && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+            *--end = '\0';
+        if (!*key || *key == '#')
+            continue;
+
+        // "key = value" as well as "key=value"
+        char* equal = strchr(key, '=');
+        char* value_start = equal ? equal +1 : end;
+        char* key_end = equal ? equal : end;
+        while (key_end > key && (key_end[-1] == ' ' || key_end[-1] == '\t'))
+            key_end--;
+        while (*value_start == ' ' || *value_start == '\t')
+            value_start++;
+        snprintf(option, sizeof(option), "--%.*s=%s", (int)(key_end - key), key, value_start);
+        if (!equal || strncmp(option, "--config=", 9) == 0 || config_option(option) != 0) {
+            log_efln("Config file %s line %d invalid: %s", config_file, number, key);
+            result = -1;
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+/// @brief Parse one option into the snapshot under construction
+/// @return 0 if OK, -1 unknown option or invalid value
+static int config_option(const char* arg) {
+    const char* value = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) != 0 || !value)
+        return -1;
+    size_t key_len = value - arg - 2;
+    value++;
+
+#define IS_KEY(k) (key_len == strlen(k) && strncmp(arg + 2, k, key_len) == 0)
+    if (IS_KEY("config"))
+        return option_config(value);
+    if (IS_KEY("mode"))
+        return option_mode(value);
+    if (IS_KEY("port"))
+        return option_int(value, 1, 65535, &cfg->listen_port);
+    if (IS_KEY("target"))
+        return option_target(value);
+    if (IS_KEY("cache-ttl"))
+        return option_cache_ttl(value);
+    if (IS_KEY("coalesce"))
+        return option_bool(value, &cfg->coalesce);
+    if (IS_KEY("max-quantity"))
+        return option_max_quantity(value);
+    if (IS_KEY("window"))
+        return option_int(value, 1, CONFIG_MAX_WINDOW, &cfg->window);
+    if (IS_KEY("timeout"))
+        return option_timeout(value);
+    if (IS_KEY("prewarm"))
+        return option_bool(value, &cfg->prewarm);
+    if (IS_KEY("master-timeout"))
+        return option_int(value, 0, 600000, &cfg->master_timeout_ms);
+    if (IS_KEY("broadcast-delay"))
+        return option_int(value, 0, 10000, &cfg->broadcast_delay_ms);
+    if (IS_KEY("baud"))
+        return option_baud(value);
+    if (IS_KEY("priority"))
+        return option_priority(value);
+    if (IS_KEY("listen"))
+        return option_listen(value);
+    if (IS_KEY("backlog"))
+        return option_int(value, 1, 65535, &cfg->backlog);
+    if (IS_KEY("max-connections"))
+        return option_int(value, 0, 1000000, &cfg->max_connections);
+    if (IS_KEY("metrics-port"))
+        return option_int(value, 0, 65535, &cfg->metrics_port);
+    if (IS_KEY("capture"))
+        return option_int(value, 0, 1 << 20, &cfg->capture_frames);
+    if (IS_KEY("capture-file"))
+        return option_capture_file(value);
+    if (IS_KEY("poll"))
+        return option_poll(value);
+    if (IS_KEY("image-shm"))
+        return option_image_shm(value);
+    if (IS_KEY("route"))
+        return option_route(value);
+#undef IS_KEY
+
+    return -1;
+}
+
+/// @brief Positional argument: mode, listen port, target host, target port
+static int config_positional(const char* value) {
+    switch (positional++) {
+        case 0: return option_mode(value);
+        case 1: return option_int(value, 1, 65535, &cfg->listen_port);
+        case 2:
+            if (!value[0] || strlen(value) >= sizeof(cfg->target_host))
+                return -1;
+            strcpy(cfg->target_host, value);
+            return 0;
+        case 3: return option_int(value, 1, 65535, &cfg->target_port);
+    }
+    return -1;
+}
+
+/// @brief New snapshot from defaults and the command line
+/// @return Snapshot or NULL if an argument is invalid (logged)
+static struct config* config_build() {
+    cfg = malloc(sizeof(struct config));
+    if (!cfg) {
+        log_efln("Config malloc failed: %s", GetLastErrorString(FALSE));
+        return NULL;
+    }
+    *cfg = defaults;
+    positional = 0;
+    int result = 0;
+    for (int i = 0; i < arg_count; i++) {
+        if (strncmp(args[i], "--", 2) == 0 ? config_option(args[i]) : config_positional(args[i])) {
+            if (strncmp(args[i], "--config=", 9) != 0)
+                log_efln("Invalid argument: %s", args[i]);
+            result = -1;
+        }
+    }
+    struct config* built = cfg;
+    cfg = NULL;
+    if (result) {
+        free(built);
+        return NULL;
+    }
+    return built;
+}
+
+int config_parse(int argc, char* argv[]) {
+    args = argv;
+    arg_count = argc;
+    current = config_build();
+    return current ? 0 : -1;
+}
+
+int config_reload() {
+    struct config* next = config_build();
+    if (!next) {
+        log_eln("Configuration not reloaded, the current one stays");
+        return -1;
+    }
+    const struct config* prev = current;
+    if (next->rtu != prev->rtu)
+        log_wln("Config: mode takes effect after restart");
+    if (next->metrics_port != prev->metrics_port)
+        log_wln("Config: metrics-port takes effect after restart");
+    if (next->capture_frames != prev->capture_frames || strcmp(next->capture_file, prev->capture_file) != 0)
+        log_wln("Config: capture settings take effect after restart");
+    if (next->poll_count != prev->poll_count
+            || memcmp(next->polls, prev->polls, next->poll_count * sizeof(struct poll_rule)) != 0
+            || strcmp(next->image_shm, prev->image_shm) != 0)
+        log_wln("Config: poll blocks and image-shm take effect after restart");
+
+    struct retired* r = malloc(sizeof(struct retired));
+    if (!r) {
+        log_efln("Config malloc failed: %s", GetLastErrorString(FALSE));
+        free(next);
+        return -1;
+    }
+    r->snapshot = InterlockedExchangePointer((PVOID volatile*)&current, next);
+    r->epoch = InterlockedIncrement64(&epoch);  // Readers acknowledging it have seen next
+    r->next = retired;
+    retired = r;
+    config_reclaim();
+    log_ifln("Configuration reloaded%s%s", config_file[0] ? " from " : "", config_file);
+    return 0;
+}
+
+void config_reclaim() {
+    if (untracked_readers)
+        return;
+    // Oldest online reader, a replaced snapshot older than its epoch is no longer referenced
+    LONG64 oldest = epoch;
+    for (int i = 0; i < CONFIG_MAX_READERS; i++) {
+        LONG64 e = reader_epochs[i];
+        if (e != READER_FREE && e != READER_OFFLINE && e < oldest)
+            oldest = e;
+    }
+    for (struct retired** p = &retired; *p; ) {
+        struct retired* r = *p;
+        if (r->epoch > oldest) {
+            p = &r->next;
+            continue;
+        }
+        *p = r->next;
+        free(r->snapshot);
+        free(r);
+    }
+}
+
+int config_reader_register() {
+    for (int i = 0; i < CONFIG_MAX_READERS; i++)
+        if (InterlockedCompareExchange64(&reader_epochs[i], epoch, READER_FREE) == READER_FREE) {
+            config_quiescent(i);    // The epoch read above may be older than the snapshot read next
+            return i;
+        }
+    log_eln("Config: too many reader threads, replaced settings are not freed any more");
+    InterlockedIncrement(&untracked_readers);
+    return -1;
+}
+
+void config_reader_unregister(int reader) {
+    if (reader < 0)
+        InterlockedDecrement(&untracked_readers);
+    else
+        InterlockedExchange64(&reader_epochs[reader], READER_FREE);
+}
+
+void config_quiescent(int reader) {
+    if (reader >= 0)
+        InterlockedExchange64(&reader_epochs[reader], epoch);
+}
+
+void config_offline(int reader) {
+    if (reader >= 0)
+        InterlockedExchange64(&reader_epochs[reader], READER_OFFLINE);
+}
+
+uint64_t config_file_time() {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!config_file[0] || !GetFileAttributesEx(config_file, GetFileExInfoStandard, &data))
+        return 0;
+    return (uint64_t)data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime;
+}
+
+void config_usage() {
+    log_ln("Options:");
+    log_ln("  --config=<file>                                key=value lines with the keys below (and mode, port, target=<host>:<port>),");
+    log_ln("                                                 reloaded when changed or with sc control <service> paramchange");
+    log_ln("  --cache-ttl=<ms>|<unit>:<ms>|<unit>:<fc>:<ms>  Answer repeated reads (0x01-0x04) from cache");
+    log_ln("  --coalesce=0|1                                 Merge queued overlapping reads (default 1)");
+    log_ln("  --max-quantity=[<unit>[-<unit>]:[<fc>:]]<n>    Split larger reads (0x01-0x04) into several upstream requests");
+    log_ln("  --window=<n>                                   Outstanding requests per Modbus TCP target, 1-64 (default 1)");
+    log_ln("  --timeout=auto|unit|<ms>                       Response timeout from RTT per target/unit, or fixed (default auto)");
+    log_ln("  --prewarm=0|1                                  Connect targets at start, reconnect idle ones (default 1)");
+    log_ln("  --master-timeout=<ms>                          Drop requests queued longer than the masters wait (default 0: never)");
+    log_ln("  --broadcast-delay=<ms>                         RTU bus turnaround after a broadcast to unit 0 (default 100)");
+    log_ln("  --baud=[<host>:<port>=]<baud>[:8E1]            Pace frames to the serial line of RTU targets (default 0: not paced)");
+    log_ln("  --priority=<addr>[/<bits>]|<port>=<class>[:<weight>]  Class 0-3 (higher first) and fair share of masters");
+    log_ln("  --listen=<port>                                Additional listener port, e.g. for --priority by port");
+    log_ln("  --backlog=<n>                                  Pending connections per listener (default 512)");
+    log_ln("  --max-connections=<n>                          Masters connected at once, more are closed (default 0: no limit)");
+    log_ln("  --metrics-port=<port>                          Prometheus metrics on http://127.0.0.1:<port>/metrics");
+    log_ln("  --capture=<frames>                             Frames kept in the capture ring, 0 disables (default 8192)");
+    log_ln("  --capture-file=<path prefix>                   Capture dumps <prefix>-<date>-<time>.pcap (default: capture next to the exe)");
+    log_ln("  --poll=<unit>:<fc>:<addr>:<qty>:<ms>           Poll block (0x01-0x04) into the image, reads inside are served from it");
+    log_ln("  --image-shm=<name>                             Publish polled blocks and ranges read by masters in shared memory (image_reader.h)");
+    log_ln("  --route=<unit>[-<unit>]=<host>:<port>          Forward unit id(s) to another target (default: positional target)");
+}
+
+int config_cache_ttl(uint8_t unit, uint8_t function_code) {
+    const struct config* cfg = current;
+    int ttl = cfg->cache_ttl_ms;
+    int specificity = 0;
+    for (int i = 0; i < cfg->cache_rule_count; i++) {
+        const struct cache_rule* rule = &cfg->cache_rules[i];
+        if (rule->unit != unit || (rule->function_code >= 0 && rule->function_code != function_code))
+            continue;
+        int s = rule->function_code >= 0 ? 2 : 1;
+        if (s >= specificity) {
+            ttl = rule->ttl_ms;
+            specificity = s;
+        }
+    }
+    return ttl;
+}
+
+int config_max_quantity(uint8_t unit, uint8_t function_code) {
+    const struct config* cfg = current;
+    int quantity = cfg->max_quantity;
+    int specificity = 0;
+    for (int i = 0; i < cfg->quantity_rule_count; i++) {
+        const struct quantity_rule* rule = &cfg->quantity_rules[i];
+        if (unit < rule->unit_first || unit > rule->unit_last
+                || (rule->function_code && rule->function_code != function_code))
+            continue;
+        int rule_specificity = rule->function_code ? 2 : 1;
+        if (rule_specificity >= specificity) {
+            quantity = rule->quantity;
+            specificity = rule_specificity;
+        }
+    }
+    return quantity;
+}
+
+void config_bus(const char* host, int port, int* baud, int* char_bits) {
+    const struct config* cfg = current;
+    *baud = 0;
+    *char_bits = 11;
+    for (int i = 0; i < cfg->bus_count; i++) {
+        const struct bus_rule* rule = &cfg->buses[i];
+        if (rule->host[0] && (rule->port != port || strcmp(rule->host, host) != 0))
+            continue;
+        *baud = rule->baud;
+        *char_bits = rule->char_bits;
+    }
+}
+
+void config_priority(uint32_t address, int port, int* priority, int* weight) {
+    const struct config* cfg = current;
+    *priority = 0;
+    *weight = 1;
+    for (int i = 0; i < cfg->priority_count; i++) {
+        const struct priority_rule* rule = &cfg->priorities[i];
+        if (rule->port ? rule->port != port : (address & rule->mask) != rule->address)
+            continue;
+        *priority = rule->priority;
+        *weight = rule->weight;
+    }
+}
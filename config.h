@@ -0,0 +1,195 @@
+/*
+ * File   : config.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Definitions for the settings of the gateway, given as
+ *               positional and --key=value arguments and/or as key=value
+ *               lines of a --config file. Settings are immutable snapshots,
+ *               a reload builds a new one and swaps it in atomically.
+ */
+
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include <stdint.h>
+
+#define CONFIG_MAX_RULES    64
+#define CONFIG_MAX_WINDOW   64
+#define CONFIG_MAX_ROUTES   64
+#define CONFIG_MAX_POLLS    64
+#define CONFIG_MAX_PRIORITIES   64
+#define CONFIG_MAX_LISTENERS    8
+#define CONFIG_MAX_BUSES    64
+#define CONFIG_PRIORITY_CLASSES 4
+#define CONFIG_MAX_ARGS     256
+#define CONFIG_MAX_READERS  256     // Threads reading snapshots (reactors, target workers, poll, metrics)
+
+
+/// @brief Cache time to live for one unit id and/or function code
+struct cache_rule {
+    int unit;                   // Unit id
+    int function_code;          // Function code, -1 for all
+    int ttl_ms;                 // Time to live, 0 disables caching
+};
+
+/// @brief Largest read a range of unit ids accepts, bigger reads of masters are split
+struct quantity_rule {
+    int unit_first;             // Unit id range, inclusive
+    int unit_last;
+    int function_code;          // 0x01-0x04, 0 for all reads
+    int quantity;               // Coils or registers
+};
+
+/// @brief Upstream target for a range of unit ids
+struct route_rule {
+    int unit_first;             // Unit id range, inclusive
+    int unit_last;
+    char host[256];             // Host-name/IP-adress of target
+    int port;                   // Port of target
+};
+
+/// @brief Serial line behind a RTU over TCP target, for pacing the frames sent to it
+struct bus_rule {
+    char host[256];             // Target, empty for all RTU over TCP targets
+    int port;
+    int baud;                   // 0 not paced
+    int char_bits;              // Bits per character: start, data, parity, stop (8E1: 11)
+};
+
+/// @brief Register block read on a schedule into the image (data concentrator)
+struct poll_rule {
+    int unit;                   // Unit id
+    int function_code;          // 0x01-0x04
+    int address;                // Start address
+    int quantity;               // Number of coils/registers, split into PDUs if needed
+    int interval_ms;            // Poll interval
+};
+
+/// @brief Priority class and fair share of masters by source address or listener port
+struct priority_rule {
+    uint32_t address;           // Source network (host byte order), address rules only
+    uint32_t mask;              // Netmask of address, 0 for port rules
+    int port;                   // Listener port, 0 for address rules
+    int priority;               // Class 0-3, queued requests of a higher class are sent first
+    int weight;                 // Share of the target within the class, relative to the others
+};
+
+/// @brief Settings snapshot
+struct config {
+    int rtu;                    // Listener protocol: 1 RTU over TCP, 0 Modbus TCP (restart to change)
+    int listen_port;            // Listener port
+    char target_host[256];      // Host-name/IP-adress of the default target
+    int target_port;            // Port of the default target
+
+    int cache_ttl_ms;           // Default response cache TTL for reads (0x01-0x04), 0 disabled
+    struct cache_rule cache_rules[CONFIG_MAX_RULES];
+    int cache_rule_count;
+
+    int coalesce;               // Merge queued overlapping/adjacent reads into one upstream request
+    int max_quantity;           // Largest read sent upstream, 0 the Modbus limit
+    struct quantity_rule quantity_rules[CONFIG_MAX_RULES];
+    int quantity_rule_count;
+    int window;                 // Max outstanding requests per Modbus TCP target
+    int timeout_ms;             // Fixed response timeout, 0 adaptive (RTT estimate per target)
+    int timeout_per_unit;       // Adaptive: estimate per unit id once it has enough samples
+    int prewarm;                // Connect targets at start and reconnect idle ones in the background
+    int master_timeout_ms;      // Drop requests still queued after this (master gave up), 0 never
+    int broadcast_delay_ms;     // Turnaround delay after a broadcast before the RTU bus takes the next request
+    struct bus_rule buses[CONFIG_MAX_BUSES];    // Later rules override earlier ones
+    int bus_count;
+
+    struct priority_rule priorities[CONFIG_MAX_PRIORITIES]; // Later rules override earlier ones
+    int priority_count;
+    int listen_ports[CONFIG_MAX_LISTENERS];     // Additional listener ports
+    int listen_count;
+    int backlog;                // Pending connections per listener (applies to listeners opened afterwards)
+    int max_connections;        // Masters connected at the same time, more are closed right away, 0 no limit
+
+    int metrics_port;           // Prometheus endpoint on 127.0.0.1, 0 disabled
+    int capture_frames;         // Frames kept in the capture ring, 0 disabled
+    char capture_file[256];     // Path prefix of capture dumps, empty: "capture" next to the executable
+
+    struct poll_rule polls[CONFIG_MAX_POLLS];       // Reads inside them are answered from the image
+    int poll_count;
+    char image_shm[128];        // Name of the shared-memory copy of the image, empty: not published
+
+    struct route_rule routes[CONFIG_MAX_ROUTES];    // Unrouted unit ids go to the positional target
+    int route_count;
+};
+
+
+/// @brief Current settings snapshot, read lock-free
+/// @brief A replaced snapshot stays valid until every registered reader has passed config_quiescent()
+/// @brief or is offline, so read values right away instead of keeping the pointer across those calls
+/// @return Settings
+const struct config* config();
+
+/// @brief Build the first snapshot from the command line, arguments are kept for config_reload()
+/// @param argc Number of arguments behind the program name
+/// @param argv Positional arguments mode, listen port, target host, target port and --key=value options,
+/// @param argv --config=<file> reads key=value lines at its position, later arguments override it
+/// @return 0 if OK, -1 invalid argument (logged)
+int config_parse(int argc, char* argv[]);
+
+/// @brief Build a new snapshot from the same arguments and the current --config file, swap it in
+/// @brief Settings that need a restart (mode, metrics, capture, polls) are logged and keep working as before
+/// @brief Never waits for readers, the replaced snapshot is freed by config_reclaim()
+/// @return 0 if swapped, -1 invalid file (logged, the current snapshot stays)
+int config_reload();
+
+/// @brief Free replaced snapshots no registered reader can hold any more (thread calling config_reload())
+void config_reclaim();
+
+/// @brief Register the calling thread as reader of snapshots, threads of the gateway that call config()
+/// @brief or the config_* lookups after start must register, the reloading thread itself need not
+/// @return Reader slot, -1 if all CONFIG_MAX_READERS are taken (logged, nothing is freed any more)
+int config_reader_register();
+
+/// @brief Release the reader slot when the thread ends
+/// @param reader Reader slot
+void config_reader_unregister(int reader);
+
+/// @brief Quiescent point: the thread holds no snapshot pointer, snapshots replaced before are not
+/// @brief referenced by it any more. Also ends config_offline()
+/// @param reader Reader slot
+void config_quiescent(int reader);
+
+/// @brief The thread blocks without holding a snapshot (accept, long sleeps), until config_quiescent()
+/// @param reader Reader slot
+void config_offline(int reader);
+
+/// @brief Last write time of the --config file, to reload on changes
+/// @return Time (FILETIME units), 0 if no file or not readable
+uint64_t config_file_time();
+
+/// @brief Print usage of all options
+void config_usage();
+
+/// @brief Cache TTL for unit id and function code, most specific rule wins
+/// @param unit Unit id
+/// @param function_code Function code
+/// @return TTL in ms, 0 if not cached
+int config_cache_ttl(uint8_t unit, uint8_t function_code);
+
+/// @brief Largest read a unit accepts, most specific rule wins (later ones on a tie)
+/// @param unit Unit id
+/// @param function_code Read function code (0x01-0x04)
+/// @return Quantity of coils or registers, 0 no limit beyond the Modbus one
+int config_max_quantity(uint8_t unit, uint8_t function_code);
+
+/// @brief Serial line of a RTU over TCP target, last matching rule wins
+/// @param host Host of the target
+/// @param port Port of the target
+/// @param baud Baud rate, 0 if no rule matches (not paced)
+/// @param char_bits Bits per character on the line
+void config_bus(const char* host, int port, int* baud, int* char_bits);
+
+/// @brief Priority class and weight of a master, last matching rule wins
+/// @param address Source address of the master (host byte order)
+/// @param port Listener port the master connected to
+/// @param priority Class, 0 if no rule matches
+/// @param weight Fair-queuing weight, 1 if no rule matches
+void config_priority(uint32_t address, int port, int* priority, int* weight);
+
+#endif
@@ -12,12 +12,12 @@
 #include <stdint.h>
 
 /// @brief Big-Endian
-uint16_t read_uint16_reverse(const uint8_t *buffer) {
+static inline uint16_t read_uint16_reverse(const uint8_t *buffer) {
     return ((uint16_t)buffer[0] << 8) | buffer[1];
 }
 
 /// @brief Big-Endian
-uint32_t read_uint32_reverse(const uint8_t *buffer) {
+static inline uint32_t read_uint32_reverse(const uint8_t *buffer) {
     return ((uint32_t)buffer[0] << 24) |
            ((uint32_t)buffer[1] << 16) |
            ((uint32_t)buffer[2] << 8)  |
@@ -25,7 +25,21 @@ uint32_t read_uint32_reverse(const uint8_t *buffer) {
 }
 
 /// @brief Big-Endian
-uint64_t read_uint64_reverse(const uint8_t *buffer) {
+static inline void write_uint16_reverse(uint8_t *buffer, uint16_t value) {
+    buffer[0] = value >> 8;
+    buffer[1] = value & 0xFF;
+}
+
+/// @brief Big-Endian
+static inline void write_uint32_reverse(uint8_t *buffer, uint32_t value) {
+    buffer[0] = value >> 24;
+    buffer[1] = (value >> 16) & 0xFF;
+    buffer[2] = (value >> 8) & 0xFF;
+    buffer[3] = value & 0xFF;
+}
+
+/// @brief Big-Endian
+static inline uint64_t read_uint64_reverse(const uint8_t *buffer) {
     return ((uint64_t)buffer[0] << 56) |
            ((uint64_t)buffer[1] << 48) |
            ((uint64_t)buffer[2] << 40) |
@@ -0,0 +1,143 @@
+/*
+ * File   : frame.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the framing of Modbus RTU byte streams
+ */
+
+#include "frame.h"
+
+#include <string.h>
+
+#include "crc.h"
+
+
+/// @brief CRC of frame ok (little endian CRC behind the data)
+static int rtu_crc_ok(const uint8_t* frame, int len) {
+    return crc16(frame, len -2) == (frame[len -1] << 8 | frame[len -2]);
+}
+
+/// @brief Length of a Read Device Identification (0x2B/0x0E) response, objects are id, length, value
+static int rtu_device_id_length(const uint8_t* frame, int len) {
+    // Unit, FC, MEI type, read code, conformity, more follows, next object, number of objects
+    if (len < 8)
+        return 0;
+    int pos = 8;
+    for (int i = 0; i < frame[7]; i++) {
+        if (len < pos +2)
+            return 0;
+        pos += 2 + frame[pos +1];
+    }
+    return pos +2;
+}
+
+int rtu_response_length(const uint8_t* frame, int len) {
+    if (len < 2)
+        return 0;
+    if (frame[1] & 0x80)
+        return 5;                           // Exception: unit, FC, code, CRC
+
+    switch (frame[1]) {
+        case 0x01: // Read Coils
+        case 0x02: // Read Discrete Inputs
+        case 0x03: // Read Holding Registers
+        case 0x04: // Read Input Registers
+        case 0x0C: // Get Comm Event Log
+        case 0x11: // Report Server ID
+        case 0x14: // Read File Record
+        case 0x15: // Write File Record
+        case 0x17: // Read/Write Multiple Registers
+            return len < 3 ? 0 : 5 + frame[2];
+        case 0x05: // Write Single Coil
+        case 0x06: // Write Single Register
+        case 0x08: // Diagnostics (echo of sub-function and data)
+        case 0x0B: // Get Comm Event Counter
+        case 0x0F: // Write Multiple Coils
+        case 0x10: // Write Multiple Registers
+            return 8;
+        case 0x07: // Read Exception Status
+            return 5;
+        case 0x16: // Mask Write Register
+            return 10;
+        case 0x18: // Read FIFO Queue: 2 byte byte count
+            return len < 4 ? 0 : 6 + (frame[2] << 8 | frame[3]);
+        case 0x2B: // Encapsulated Interface Transport
+            if (len < 3)
+                return 0;
+            return frame[2] == 0x0E ? rtu_device_id_length(frame, len) : -1;
+        default:
+            return -1;
+    }
+}
+
+int rtu_request_length(const uint8_t* frame, int len) {
+    if (len < 2)
+        return 0;
+
+    switch (frame[1]) {
+        case 0x01: // Read Coils
+        case 0x02: // Read Discrete Inputs
+        case 0x03: // Read Holding Registers
+        case 0x04: // Read Input Registers
+        case 0x05: // Write Single Coil
+        case 0x06: // Write Single Register
+        case 0x08: // Diagnostics (sub-function and data)
+            return 8;
+        case 0x07: // Read Exception Status
+        case 0x0B: // Get Comm Event Counter
+        case 0x0C: // Get Comm Event Log
+        case 0x11: // Report Server ID
+            return 4;
+        case 0x0F: // Write Multiple Coils
+        case 0x10: // Write Multiple Registers
+            return len < 7 ? 0 : 9 + frame[6];
+        case 0x14: // Read File Record
+        case 0x15: // Write File Record
+            return len < 3 ? 0 : 5 + frame[2];
+        case 0x16: // Mask Write Register
+            return 10;
+        case 0x17: // Read/Write Multiple Registers
+            return len < 11 ? 0 : 13 + frame[10];
+        case 0x18: // Read FIFO Queue
+            return 6;
+        case 0x2B: // Encapsulated Interface Transport
+            if (len < 3)
+                return 0;
+            return frame[2] == 0x0E ? 7 : -1;   // Read Device Identification: MEI type, code, object id
+        default:
+            return -1;
+    }
+}
+
+int rtu_frame_length(const uint8_t* buf, int len, rtu_length_fn length) {
+    int frame_len = length(buf, len);
+
+    if (frame_len < 0) {
+        // Unknown function code: first position with matching CRC
+        for (int n = 4; n <= len && n <= RTU_MAX_LEN; n++)
+            if (rtu_crc_ok(buf, n))
+                return n;
+        return len < RTU_MAX_LEN ? 0 : enSIMPLE_TCP_error_crc;
+    }
+    if (frame_len > RTU_MAX_LEN)
+        return enSIMPLE_TCP_error_tooMuchData;
+    if (frame_len == 0 || len < frame_len)
+        return 0;
+    return rtu_crc_ok(buf, frame_len) ? frame_len : enSIMPLE_TCP_error_crc;
+}
+
+int rtu_stream_frame(struct rtu_stream* s, rtu_length_fn length, uint8_t* frame) {
+    int frame_len = rtu_frame_length(s->buf, s->len, length);
+    if (frame_len < 0) {
+        s->len = 0;             // Resync
+        return frame_len;
+    }
+    if (frame_len == 0)
+        return 0;
+
+    memcpy(frame, s->buf, frame_len);
+    s->len -= frame_len;
+    memmove(s->buf, s->buf + frame_len, s->len);
+    return frame_len;
+}
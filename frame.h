@@ -0,0 +1,62 @@
+/*
+ * File   : frame.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the framing of Modbus RTU byte streams.
+ *               RTU has no length field, frame boundaries are decoded from
+ *               function code, exception bit and byte count fields.
+ */
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stdint.h>
+
+#include "comm.h"
+
+#define RTU_MAX_LEN     256     // Unit id + PDU (253) + CRC
+
+
+/// @brief Length decoder for one direction of RTU frames
+/// @param frame Start of frame (unit id, function code, ...)
+/// @param len Bytes available
+/// @return >0 Length of frame including unit id and CRC, 0 more bytes needed, -1 unknown function code
+typedef int (*rtu_length_fn)(const uint8_t* frame, int len);
+
+/// @brief Received bytes of an RTU byte stream, keeps the start of the next frame between calls
+struct rtu_stream {
+    uint8_t buf[2 * RTU_MAX_LEN];
+    int len;
+};
+
+
+/// @brief Length of a response from a slave, for all public function codes
+/// @param frame Start of frame
+/// @param len Bytes available
+/// @return >0 Length of frame including unit id and CRC, 0 more bytes needed, -1 unknown function code
+int rtu_response_length(const uint8_t* frame, int len);
+
+/// @brief Length of a request from a master, for all public function codes
+/// @param frame Start of frame
+/// @param len Bytes available
+/// @return >0 Length of frame including unit id and CRC, 0 more bytes needed, -1 unknown function code
+int rtu_request_length(const uint8_t* frame, int len);
+
+/// @brief Length of the complete frame at the start of buf
+/// @brief Frames of unknown function codes end at the first matching CRC
+/// @param buf Received bytes
+/// @param len Number of received bytes
+/// @param length Length decoder for the direction of the stream
+/// @return >0 Length of frame including CRC (checked), 0 more bytes needed, <0 error (see enSIMPLE_TCP)
+int rtu_frame_length(const uint8_t* buf, int len, rtu_length_fn length);
+
+/// @brief Take the next complete frame out of the stream (see rtu_frame_length)
+/// @param s Stream
+/// @param length Length decoder for the direction of the stream
+/// @param frame Buffer for the frame (RTU_MAX_LEN)
+/// @return >0 Length of frame including CRC (checked), 0 more bytes needed,
+/// @return <0 error (see enSIMPLE_TCP), the buffered bytes are dropped to resync
+int rtu_stream_frame(struct rtu_stream* s, rtu_length_fn length, uint8_t* frame);
+
+#endif
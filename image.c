@@ -0,0 +1,234 @@
+/*
+ * File   : image.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the shared-memory register image. The
+ *               mapping is named Global\<name> when the process may create
+ *               global objects (service), Local\<name> otherwise. The polled
+ *               blocks come first, the ranges masters read are appended on
+ *               their first successful read. Writers of a block take its
+ *               seqlock with a compare-exchange, readers retry around it.
+ */
+
+#include "image.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "image_reader.h"
+#include "cli.h"
+#include "comm.h"
+#include "config.h"
+#include "endian.h"
+
+
+#define IMAGE_READ_BLOCKS   1024                    // Ranges of master reads, registered on first success
+#define IMAGE_INDEX_SIZE    (2 * IMAGE_READ_BLOCKS)     // Open addressing, power of two
+
+
+static struct image_header* header = NULL;     // NULL if not published
+static uint8_t* blocks;
+static int block_capacity;                      // Polled blocks + IMAGE_READ_BLOCKS
+static int polled_count;                        // Blocks of --poll, the ones of master reads follow
+
+static SRWLOCK index_lock = SRWLOCK_INIT;       // Exclusive to register a read block
+static int read_index[IMAGE_INDEX_SIZE];        // Block of a read range, -1 free
+static boolean full_logged;
+
+
+static struct image_block* image_at(int index) {
+    return (struct image_block*)(blocks + (size_t)index * sizeof(struct image_block));
+}
+
+/// @brief Take the seqlock of a block: odd, readers retry. Target workers may publish the same block
+static void image_write_begin(struct image_block* b) {
+    for (;;) {
+        LONG seq = b->seq;
+        if (!(seq & 1) && InterlockedCompareExchange(&b->seq, seq +1, seq) == seq)
+            return;
+        YieldProcessor();
+    }
+}
+
+/// @brief Release the seqlock of a block: even, consistent
+static void image_write_end(struct image_block* b) {
+    InterlockedIncrement(&b->seq);
+}
+
+int image_start(int block_count) {
+    const char* name = config()->image_shm;
+    if (!name[0])
+        return 0;
+    polled_count = block_count;
+    block_capacity = block_count + IMAGE_READ_BLOCKS;
+    memset(read_index, -1, sizeof(read_index));
+
+    static const char* prefixes[] = { "Global\\", "Local\\" };
+    char path[MAX_PATH];
+    size_t size = sizeof(struct image_header) + (size_t)block_capacity * sizeof(struct image_block);
+    HANDLE mapping = NULL;
+    for (int i = 0; i < 2 && !mapping; i++) {
+        snprintf(path, sizeof(path), "%s%s", prefixes[i], name);
+        mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, path);
+    }
+    struct image_header* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+    if (!view) {
+        // Also if a reader still holds a smaller image of a previous run
+        log_efln("Register image %s not created: %s", name, GetLastErrorString(FALSE));
+        if (mapping)
+            CloseHandle(mapping);
+        return -1;
+    }
+
+    // Kept mapped until the process ends, readers see a dead gateway by gateway_pid
+    view->magic = 0;
+    MemoryBarrier();
+    memset((uint8_t*)view + sizeof(uint32_t), 0, size - sizeof(uint32_t));
+    view->version = IMAGE_VERSION;
+    view->header_size = sizeof(struct image_header);
+    view->block_size = sizeof(struct image_block);
+    view->block_count = block_count;
+    view->gateway_pid = GetCurrentProcessId();
+    view->started_us = time_us();
+    header = view;
+    blocks = (uint8_t*)view + view->header_size;
+    log_fln("Register image of %d polled blocks and up to %d ranges read by masters published as %s (%zu KB)",
+        block_count, IMAGE_READ_BLOCKS, path, size / 1024);
+    return 0;
+}
+
+void image_describe(int index, uint8_t unit, uint8_t function_code, uint16_t address, uint16_t quantity, int interval_ms) {
+    if (!header)
+        return;
+    struct image_block* b = image_at(index);
+    b->unit = unit;
+    b->function_code = function_code;
+    b->address = address;
+    b->quantity = quantity;
+    b->interval_ms = interval_ms;
+}
+
+void image_activate() {
+    if (!header)
+        return;
+    MemoryBarrier();
+    header->magic = IMAGE_MAGIC;
+}
+
+void image_publish(int index, const uint8_t* rsp, int rsp_len, uint64_t updated_us) {
+    if (!header)
+        return;
+    struct image_block* b = image_at(index);
+    image_write_begin(b);
+    b->valid = rsp_len > 3;
+    if (rsp_len > 3 && (b->function_code == 0x03 || b->function_code == 0x04)) {
+        uint16_t* registers = (uint16_t*)b->data;
+        for (int i = 0; i < b->quantity; i++)
+            registers[i] = read_uint16_reverse(rsp +3 + i*2);
+    } else if (rsp_len > 3) {
+        memcpy(b->data, rsp +3, rsp_len -3);
+    }
+    b->updated_us = updated_us;
+    image_write_end(b);
+}
+
+/// @brief Block of a read range, registered if new (and room left)
+/// @return Block index, -1 if the image is full
+static int image_read_block(uint8_t unit, uint8_t function_code, uint16_t address, uint16_t quantity) {
+    uint32_t key = (uint32_t)unit << 24 ^ (uint32_t)function_code << 16 ^ address ^ (uint32_t)quantity * 2654435761u;
+    uint32_t slot = (key ^ key >> 15) & (IMAGE_INDEX_SIZE -1);
+
+    AcquireSRWLockShared(&index_lock);
+    for (;; slot = (slot +1) & (IMAGE_INDEX_SIZE -1)) {
+        int index = read_index[slot];
+        if (index < 0)
+            break;
+        const struct image_block* b = image_at(index);
+        if (b->unit == unit && b->function_code == function_code && b->address == address && b->quantity == quantity) {
+            ReleaseSRWLockShared(&index_lock);
+            return index;
+        }
+    }
+    ReleaseSRWLockShared(&index_lock);
+
+    AcquireSRWLockExclusive(&index_lock);
+    int index = -1;
+    for (;; slot = (slot +1) & (IMAGE_INDEX_SIZE -1)) {
+        index = read_index[slot];
+        if (index < 0)
+            break;
+        const struct image_block* b = image_at(index);
+        if (b->unit == unit && b->function_code == function_code && b->address == address && b->quantity == quantity)
+            break;              // Registered meanwhile
+    }
+    if (index < 0 && (int)header->block_count < block_capacity) {
+        index = (int)header->block_count;
+        image_describe(index, unit, function_code, address, quantity, 0);
+        read_index[slot] = index;
+        MemoryBarrier();        // Described before readers count it
+        header->block_count = index +1;
+    } else if (index < 0 && !full_logged) {
+        full_logged = TRUE;
+        log_wfln("Register image full, reads of further ranges are not published (%d ranges)", IMAGE_READ_BLOCKS);
+    }
+    ReleaseSRWLockExclusive(&index_lock);
+    return index;
+}
+
+/// @brief Mark the read blocks a write may have changed, the next master read publishes them again
+static void image_written(const uint8_t* req, int req_len, boolean broadcast) {
+    uint8_t function_code = req[1];
+    uint32_t address = read_uint16_reverse(req +2);
+    uint32_t quantity;
+    uint8_t image_fc;
+
+    switch (function_code) {
+        case 0x05: image_fc = 0x01; quantity = 1; break;
+        case 0x06: image_fc = 0x03; quantity = 1; break;
+        case 0x0F: image_fc = 0x01; quantity = read_uint16_reverse(req +4); break;
+        case 0x10: image_fc = 0x03; quantity = read_uint16_reverse(req +4); break;
+        case 0x16: image_fc = 0x03; quantity = 1; break;
+        case 0x17:
+            if (req_len < 10)
+                return;
+            image_fc = 0x03;
+            address = read_uint16_reverse(req +6);
+            quantity = read_uint16_reverse(req +8);
+            break;
+        default: return;
+    }
+
+    int count = (int)header->block_count;
+    for (int i = polled_count; i < count; i++) {
+        struct image_block* b = image_at(i);
+        if ((b->unit != req[0] && !broadcast) || b->function_code != image_fc || !b->valid
+                || address >= (uint32_t)b->address + b->quantity || b->address >= address + quantity)
+            continue;
+        image_write_begin(b);
+        b->valid = 0;
+        image_write_end(b);
+    }
+}
+
+void image_transaction(const uint8_t* req, int req_len, const uint8_t* rsp, int rsp_len) {
+    if (!header || req_len < 6)
+        return;
+    boolean broadcast = rsp_len == enSIMPLE_TCP_broadcast;
+    if (!read_max_quantity(req[1])) {
+        // Also on error, the write might have happened
+        if (rsp_len <= 0 || broadcast || !(rsp[1] & 0x80))
+            image_written(req, req_len, broadcast);
+        return;
+    }
+
+    uint16_t quantity = read_uint16_reverse(req +4);
+    if (req_len != 6 || rsp_len <= 0 || rsp[1] != req[1] || quantity < 1 || quantity > read_max_quantity(req[1])
+            || rsp_len != 1 + expected_pdu_length(req[1], quantity))
+        return;
+    int index = image_read_block(req[0], req[1], read_uint16_reverse(req +2), quantity);
+    if (index >= 0)
+        image_publish(index, rsp, rsp_len, time_us());
+}
@@ -0,0 +1,51 @@
+/*
+ * File   : image.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for publishing the register image in shared
+ *               memory: the blocks of the data concentrator (see poll.h) and
+ *               the ranges masters read through the gateway. Layout and
+ *               reader library in image_reader.h.
+ */
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdint.h>
+
+
+/// @brief Create the file mapping for block_count polled blocks and the ranges of master reads
+/// @brief (--image-shm), no-op if not configured
+/// @param block_count Polled blocks, 0 without --poll
+/// @return 0 if OK or disabled, -1 error (logged)
+int image_start(int block_count);
+
+/// @brief Describe block, before image_activate()
+/// @param index Block index
+/// @param unit Unit id
+/// @param function_code 0x01-0x04
+/// @param address First coil/register
+/// @param quantity Coils/registers
+/// @param interval_ms Poll interval
+void image_describe(int index, uint8_t unit, uint8_t function_code, uint16_t address, uint16_t quantity, int interval_ms);
+
+/// @brief Open the image for readers, all blocks are described
+void image_activate();
+
+/// @brief Publish values of a block
+/// @param index Block index
+/// @param rsp Read response (unit id + PDU) of the block
+/// @param rsp_len Length of rsp, 0 marks the values invalid
+/// @param updated_us Time of the data (time_us)
+void image_publish(int index, const uint8_t* rsp, int rsp_len, uint64_t updated_us);
+
+/// @brief Publish the response of a master's read (0x01-0x04) in the block of its range, registered
+/// @brief on the first successful read. A write marks the read blocks it overlaps invalid (target worker thread)
+/// @param req Request (unit id + PDU)
+/// @param req_len Length of req
+/// @param rsp Response (unit id + PDU)
+/// @param rsp_len Length of rsp, <=0 error (see enSIMPLE_TCP)
+void image_transaction(const uint8_t* req, int req_len, const uint8_t* rsp, int rsp_len);
+
+#endif
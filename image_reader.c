@@ -0,0 +1,150 @@
+/*
+ * File   : image_reader.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the reader library of the shared-memory
+ *               register image. Self-contained, only Windows headers, to be
+ *               built into historians, alarm engines and other consumers.
+ */
+
+#include "image_reader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+int image_open(struct image_reader* r, const char* name) {
+    static const char* prefixes[] = { "Global\\", "Local\\" };
+    char path[MAX_PATH];
+
+    memset(r, 0, sizeof(struct image_reader));
+    for (int i = 0; i < 2 && !r->mapping; i++) {
+        snprintf(path, sizeof(path), "%s%s", prefixes[i], name);
+        r->mapping = OpenFileMapping(FILE_MAP_READ, FALSE, path);
+    }
+    if (!r->mapping)
+        return -1;
+
+    const struct image_header* header = MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!header || header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION
+            || header->block_size < sizeof(struct image_block)) {
+        if (header)
+            UnmapViewOfFile(header);
+        CloseHandle(r->mapping);
+        r->mapping = NULL;
+        return -1;
+    }
+    MemoryBarrier();            // Descriptions are complete once magic is set
+    r->header = header;
+    r->blocks = (const uint8_t*)header + header->header_size;
+    return 0;
+}
+
+void image_close(struct image_reader* r) {
+    if (r->header)
+        UnmapViewOfFile(r->header);
+    if (r->mapping)
+        CloseHandle(r->mapping);
+    memset(r, 0, sizeof(struct image_reader));
+}
+
+int image_block_count(const struct image_reader* r) {
+    return (int)r->header->block_count;
+}
+
+const struct image_block* image_block(const struct image_reader* r, int index) {
+    if (index < 0 || (uint32_t)index >= r->header->block_count)
+        return NULL;
+    return (const struct image_block*)(r->blocks + (size_t)index * r->header->block_size);
+}
+
+int image_block_copy(const struct image_reader* r, int index, struct image_block* copy) {
+    const struct image_block* b = image_block(r, index);
+    if (!b)
+        return -1;
+    for (;;) {
+        LONG seq = b->seq;
+        if (seq & 1) {
+            YieldProcessor();   // Gateway is writing
+            continue;
+        }
+        MemoryBarrier();
+        memcpy(copy, (const void*)b, sizeof(struct image_block));
+        MemoryBarrier();
+        if (b->seq == seq) {
+            copy->seq = seq;
+            return 0;
+        }
+    }
+}
+
+/// @brief Copy coils/registers [address, end) out of one block under its seqlock
+/// @return 0 if OK, -1 block without valid data
+static int image_copy_part(const struct image_block* b, uint16_t address, uint32_t end, uint32_t first,
+                           void* values, uint64_t* updated_us) {
+    uint32_t offset = address - b->address;
+    uint32_t count = end - address;
+    boolean registers = b->function_code == 0x03 || b->function_code == 0x04;
+    for (;;) {
+        LONG seq = b->seq;
+        if (seq & 1) {
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        uint16_t valid = b->valid;
+        uint64_t updated = b->updated_us;
+        if (registers) {
+            memcpy((uint16_t*)values + (address - first), b->data + offset*2, count*2);
+        } else {
+            uint8_t* bits = (uint8_t*)values + (address - first);
+            for (uint32_t i = 0; i < count; i++)
+                bits[i] = (b->data[(offset + i)/8] >> ((offset + i)%8)) & 1;
+        }
+        MemoryBarrier();
+        if (b->seq != seq)
+            continue;           // Updated meanwhile
+        if (!valid)
+            return -1;
+        if (updated_us && updated < *updated_us)
+            *updated_us = updated;
+        return 0;
+    }
+}
+
+int image_read(const struct image_reader* r, uint8_t unit, uint8_t function_code, uint16_t address, uint16_t quantity,
+               void* values, uint64_t* updated_us) {
+    uint32_t end = (uint32_t)address + quantity;
+    if (updated_us)
+        *updated_us = UINT64_MAX;
+
+    for (uint32_t a = address; a < end; ) {
+        // A range may be in a polled block and in blocks of master reads, take one with data
+        const struct image_block* found = NULL;
+        uint32_t count = r->header->block_count;
+        for (uint32_t i = 0; i < count && !(found && found->valid); i++) {
+            const struct image_block* b = (const struct image_block*)(r->blocks + (size_t)i * r->header->block_size);
+            if (b->unit == unit && b->function_code == function_code
+                    && a >= b->address && a < (uint32_t)b->address + b->quantity)
+                found = b;
+        }
+        if (!found)
+            return -1;
+        uint32_t part_end = (uint32_t)found->address + found->quantity < end ? (uint32_t)found->address + found->quantity : end;
+        if (image_copy_part(found, (uint16_t)a, part_end, address, values, updated_us))
+            return -1;
+        a = part_end;
+    }
+    return 0;
+}
+
+uint64_t image_now_us() {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000
+         + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
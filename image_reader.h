@@ -0,0 +1,116 @@
+/*
+ * File   : image_reader.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Layout of the register image the gateway publishes in shared
+ *               memory (--image-shm) and the reader library for local
+ *               consumers. Readers copy values lock-free under the seqlock of
+ *               each block, without sockets or syscalls. A consumer only
+ *               needs this header and image_reader.c.
+ *
+ * Layout of the file mapping "Global\<name>" (service) or "Local\<name>":
+ *
+ *   offset 0            struct image_header
+ *   header_size         block 0, struct image_block
+ *   + i * block_size    block i
+ *
+ * Little endian, natural alignment. The blocks of --poll come first and are
+ * described before magic is set. The ranges masters read through the gateway
+ * follow: block_count grows when a new range is read successfully, its block
+ * is described before. Descriptions (unit, function code, address, quantity,
+ * interval) never change, values change under the seqlock: the gateway makes
+ * seq odd, writes, makes it even again. A reader takes seq, copies, and
+ * retries if seq was odd or changed.
+ * A restarted gateway rewrites the image, readers reopen when gateway_pid or
+ * started_us change.
+ */
+
+#ifndef __IMAGE_READER_H__
+#define __IMAGE_READER_H__
+
+#include <stdint.h>
+#include <windows.h>
+
+#define IMAGE_MAGIC         0x4D49424D  // "MBIM"
+#define IMAGE_VERSION       1
+#define IMAGE_DATA_SIZE     256         // 125 registers or 2000 coils, padded
+
+
+/// @brief Start of the mapping
+struct image_header {
+    volatile uint32_t magic;        // IMAGE_MAGIC once the blocks are described, 0 before
+    uint32_t version;               // IMAGE_VERSION, readers reject other versions
+    uint32_t header_size;           // Offset of block 0
+    uint32_t block_size;            // Distance of the blocks
+    volatile uint32_t block_count;  // Blocks described so far, grows with the ranges of master reads
+    uint32_t gateway_pid;           // Process publishing the image
+    uint64_t started_us;            // Publisher start, same clock as updated_us
+};
+
+/// @brief One polled block (--poll ranges are merged and split at the PDU limit) or range read by a master
+struct image_block {
+    volatile LONG seq;              // Seqlock: odd while written, changes with every update
+    uint8_t unit;
+    uint8_t function_code;          // 0x01-0x04
+    uint16_t address;               // First coil/register
+    uint16_t quantity;              // Coils/registers
+    uint16_t valid;                 // 1 last poll succeeded, 0 no data (not polled yet, failed, unknown after a write)
+    uint32_t interval_ms;           // Poll interval, 0 for a range read by masters (updated with their reads)
+    uint64_t updated_us;            // Time of the data, QueryPerformanceCounter in microseconds (image_now_us)
+    uint8_t data[IMAGE_DATA_SIZE];  // 0x03/0x04: uint16_t registers in host byte order, 0x01/0x02: bits, LSB of byte 0 first
+};
+
+/// @brief Open image of a consumer
+struct image_reader {
+    HANDLE mapping;
+    const struct image_header* header;
+    const uint8_t* blocks;          // Block 0
+};
+
+
+/// @brief Open the image of a running gateway, Global\<name> first, then Local\<name>
+/// @param r Reader
+/// @param name Name given to the gateway with --image-shm
+/// @return 0 if OK, -1 not published (yet) or other layout version
+int image_open(struct image_reader* r, const char* name);
+
+/// @brief Unmap the image
+/// @param r Reader
+void image_close(struct image_reader* r);
+
+/// @brief Number of blocks, grows while masters read new ranges
+/// @param r Reader
+/// @return Blocks
+int image_block_count(const struct image_reader* r);
+
+/// @brief Description of a block, its values are only consistent in a copy (image_block_copy)
+/// @param r Reader
+/// @param index Block index
+/// @return Block, NULL if index out of range
+const struct image_block* image_block(const struct image_reader* r, int index);
+
+/// @brief Consistent copy of a block
+/// @param r Reader
+/// @param index Block index
+/// @param copy Copy of description, seq, valid flag, update time and values
+/// @return 0 if OK, -1 index out of range
+int image_block_copy(const struct image_reader* r, int index, struct image_block* copy);
+
+/// @brief Read coils or registers, the range may span several blocks, blocks with valid data are preferred
+/// @param r Reader
+/// @param unit Unit id
+/// @param function_code 0x01-0x04 like the Modbus read
+/// @param address First coil/register
+/// @param quantity Coils/registers
+/// @param values Registers (uint16_t[quantity]) or coils/inputs (uint8_t[quantity], 0 or 1)
+/// @param updated_us Time of the oldest block read (image_now_us), NULL if not needed
+/// @return 0 if OK, -1 range not completely in blocks with valid data
+int image_read(const struct image_reader* r, uint8_t unit, uint8_t function_code, uint16_t address, uint16_t quantity,
+               void* values, uint64_t* updated_us);
+
+/// @brief Current time on the clock of updated_us, for the age of values
+/// @return Microseconds
+uint64_t image_now_us();
+
+#endif
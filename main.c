@@ -1,177 +1,340 @@
-/*
- * File   : main.c
- * Author : Thomas Mailaender
- * Date   : 2025-09-16
- *
- * Description : Implementation of a Windows Service and console programm
- *               to realize a gateway between Modbus TCP ↔ Modbus RTU over TCP
- */
-
-
-#include <stdint.h>
-//#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <mstcpip.h>  // Für tcp_keepalive und SIO_KEEPALIVE_VALS
-#include <windows.h>
-#include <time.h>
-
-#include "cli.h"
-#include "comm.h"
-
-#pragma comment(lib, "ws2_32.lib")
-
-#define SERVICE_NAME "ModbusProxyService"
-
-SERVICE_STATUS_HANDLE g_StatusHandle;
-HANDLE g_StopEvent;
-
-void WINAPI ServiceMain(DWORD, LPTSTR *);
-void WINAPI ServiceCtrlHandler(DWORD);
-DWORD WINAPI ProxyThread(LPVOID);
-DWORD WINAPI threadHandleSocket(LPVOID lpParamSocket);
-
-volatile boolean stop = FALSE;      // When service stopped, stop => true
-SOCKET listener;
-int listener_port = 1502;
-char target_host[256] = "127.0.0.1";
-int target_port = 502;
-boolean rtu_mode = FALSE;
-
-
-/// @brief For loop checks, verify if service is stopped
-/// @return 
-volatile boolean isStop() { return stop; }
-
-const char* targetHost() { return target_host; }
-const int targetPort() { return target_port; }
-
-int main(int argc, char *argv[]) {
-    if (argc >= 2 && (strcmp(argv[1], "rtu") != 0 && strcmp(argv[1], "tcp") != 0)) {
-        log_fln("Usage: %s rtu|tcp <listen_port> <target_host> <target_port>", argv[0]);
-        return 1;
-    } else {
-        if (argc >= 2) rtu_mode = strcmp(argv[1], "rtu") == 0;
-        if (argc >= 3) listener_port = atoi(argv[2]);
-        if (argc >= 4) strcpy(target_host, argv[3]);
-        if (argc >= 5) target_port = atoi(argv[4]);
-    }
-
-    SERVICE_TABLE_ENTRY ServiceTable[] = {
-        {SERVICE_NAME, ServiceMain},
-        {NULL, NULL}
-    };
-    if (!StartServiceCtrlDispatcher(ServiceTable)) {
-        // Fehler beim Start als Dienst → vermutlich Konsolenmodus
-        DWORD err = GetLastError();
-        if (err == ERROR_FAILED_SERVICE_CONTROLLER_CONNECT) {
-            ProxyThread(NULL);
-            return 0;
-        } else {
-            log_efln("StartServiceCtrlDispatcher failed: %lu", err);
-            return 1;
-        }
-    }
-    return 0;
-}
-
-void WINAPI ServiceMain(DWORD argc, LPTSTR *argv) {
-    g_StatusHandle = RegisterServiceCtrlHandler(SERVICE_NAME, ServiceCtrlHandler);
-    g_StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-
-    SetServiceStatus(g_StatusHandle, &(SERVICE_STATUS){SERVICE_WIN32_OWN_PROCESS, SERVICE_RUNNING, 1});
-    CreateThread(NULL, 0, ProxyThread, NULL, 0, NULL);
-    WaitForSingleObject(g_StopEvent, INFINITE);
-    SetServiceStatus(g_StatusHandle, &(SERVICE_STATUS){SERVICE_WIN32_OWN_PROCESS, SERVICE_STOPPED});
-}
-
-void WINAPI ServiceCtrlHandler(DWORD ctrlCode) {
-    switch (ctrlCode) {
-        case SERVICE_CONTROL_STOP:
-            stop = TRUE;
-            if (listener != INVALID_SOCKET) {
-                closesocket(listener);
-                listener = INVALID_SOCKET;
-            }
-            SetEvent(g_StopEvent);
-
-            SERVICE_STATUS status;
-            status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
-            status.dwCurrentState = SERVICE_STOP_PENDING;
-            status.dwControlsAccepted = 1;
-            status.dwWin32ExitCode = 0;
-            status.dwCheckPoint = 1;
-            status.dwWaitHint = 1000;
-            SetServiceStatus(g_StatusHandle, &status);
-    }
-}
-
-DWORD WINAPI ProxyThread(LPVOID lpParam) {
-    WSADATA wsa;
-    WSAStartup(MAKEWORD(2,2), &wsa);
-
-    rtu_mode
-        ? log_ln("RTU over TCP <-> TCP")
-        : log_ln("TCP <-> RTU over TCP");
-
-    listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (listener == INVALID_SOCKET) {
-        log_efln("Socket creation failed: %s", GetLastErrorString(FALSE));
-        WSACleanup();
-        return 1;
-    }
-    struct sockaddr_in addr = {AF_INET, htons(listener_port), INADDR_ANY};
-    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
-        log_efln("Bind failed: %s", GetLastErrorString(FALSE));
-        closesocket(listener);
-        WSACleanup();
-        return 1;
-    }
-    if (listen(listener, 5) == SOCKET_ERROR) {
-        log_efln("Listen failed: %s", GetLastErrorString(FALSE));;
-        closesocket(listener);
-        WSACleanup();
-        return 1;
-    }
-    log_fln("Listening on port %d...", listener_port);
-
-    while (!stop) {
-        SOCKET client = accept(listener, NULL, NULL);
-        if (client == INVALID_SOCKET) {
-            log_efln("Accept failed: %s", GetLastErrorString(FALSE));
-            closesocket(client);
-        } else {
-#define MULTITHREADING
-#ifndef MULTITHREADING
-            if (rtu_mode)
-                handleSocket_RTU2TCP(client);
-            else
-                handleSocket_TCP2RTU(client);
-#else
-            SOCKET* sockPtr = malloc(sizeof(SOCKET));
-            if (!sockPtr) {
-                log_efln("malloc failed: %s", GetLastErrorString(FALSE));
-                continue;
-            }
-            *sockPtr = client;
-            CreateThread(NULL, 0, threadHandleSocket, sockPtr, 0, NULL);
-#endif
-        }
-    }
-
-    WSACleanup();
-    return 0;
-}
-
-DWORD WINAPI threadHandleSocket(LPVOID lpParamSocket) {
-    SOCKET sock = *(SOCKET*)lpParamSocket;
-    free(lpParamSocket);
-    if (rtu_mode)
-        handleSocket_RTU2TCP(sock);
-    else
-        handleSocket_TCP2RTU(sock);
-    return 0;
-}
+/*
+ * File   : main.c
+ * Author : Thomas Mailaender
+ * Date   : 2025-09-16
+ *
+ * Description : Implementation of a Windows Service and console programm
+ *               to realize a gateway between Modbus TCP ↔ Modbus RTU over TCP
+ */
+
+
+#include <stdint.h>
+//#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mstcpip.h>  // Für tcp_keepalive und SIO_KEEPALIVE_VALS
+#include <windows.h>
+#include <time.h>
+
+#include "cli.h"
+#include "comm.h"
+#include "target.h"
+#include "route.h"
+#include "poll.h"
+#include "reactor.h"
+#include "config.h"
+#include "metrics.h"
+#include "sim.h"
+#include "bench.h"
+#include "capture.h"
+#include "replay.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+#define SERVICE_NAME "ModbusProxyService"
+#define ACCEPT_BATCH 64         // Accepts per listener and poll round
+
+SERVICE_STATUS_HANDLE g_StatusHandle;
+HANDLE g_StopEvent;
+
+void WINAPI ServiceMain(DWORD, LPTSTR *);
+void WINAPI ServiceCtrlHandler(DWORD);
+BOOL WINAPI ConsoleCtrlHandler(DWORD);
+DWORD WINAPI ProxyThread(LPVOID);
+
+volatile boolean stop = FALSE;      // When service stopped, stop => true
+volatile boolean reload = FALSE;    // Reload of the --config file requested
+SOCKET listeners[1 + CONFIG_MAX_LISTENERS];   // Listener port, then --listen ports
+int listener_ports[1 + CONFIG_MAX_LISTENERS];
+int listener_count = 0;
+boolean rtu_mode = FALSE;           // Fixed at start, see config()->rtu
+
+
+/// @brief For loop checks, verify if service is stopped
+/// @return 
+volatile boolean isStop() { return stop; }
+
+int main(int argc, char *argv[]) {
+    // Benchmark tools, see bench.cmd
+    if (argc > 1 && strcmp(argv[1], "sim") == 0)
+        return sim_main(argc -2, argv +2);
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return bench_main(argc -2, argv +2);
+    if (argc > 1 && strcmp(argv[1], "storm") == 0)
+        return bench_storm_main(argc -2, argv +2);
+    if (argc > 1 && strcmp(argv[1], "image") == 0)
+        return bench_image_main(argc -2, argv +2);
+    if (argc > 1 && strcmp(argv[1], "crc") == 0)
+        return bench_crc_main(argc -2, argv +2);
+    if (argc > 1 && strcmp(argv[1], "frame") == 0)
+        return bench_frame_main(argc -2, argv +2);
+    if (argc > 1 && strcmp(argv[1], "check") == 0)
+        return bench_check_main(argc -2, argv +2);
+    if (argc > 1 && strcmp(argv[1], "replay") == 0)
+        return replay_main(argc -2, argv +2);
+
+    if (config_parse(argc -1, argv +1)) {
+        log_fln("Usage: %s rtu|tcp <listen_port> <target_host> <target_port> [--option=value ...]", argv[0]);
+        log_fln("       %s --config=<file> [--option=value ...]", argv[0]);
+        log_fln("       %s sim tcp|rtu <port> [delay_ms] [baud] [reorder_ms]", argv[0]);
+        log_fln("       %s bench tcp|rtu <host> <port> [connections,...] [seconds] [quantity]", argv[0]);
+        log_fln("       %s storm tcp|rtu <host> <port> [clients] [seconds]", argv[0]);
+        log_fln("       %s image <name> [threads,...] [seconds] [quantity]", argv[0]);
+        log_fln("       %s crc [seconds]", argv[0]);
+        log_fln("       %s frame [seconds]", argv[0]);
+        log_fln("       %s check tcp|rtu <host> <port> [address] [rounds]", argv[0]);
+        log_fln("       %s replay tcp|rtu <capture.pcap> <host> <port> [speed|max]", argv[0]);
+        config_usage();
+        return 1;
+    }
+
+    SERVICE_TABLE_ENTRY ServiceTable[] = {
+        {SERVICE_NAME, ServiceMain},
+        {NULL, NULL}
+    };
+    if (!StartServiceCtrlDispatcher(ServiceTable)) {
+        // Fehler beim Start als Dienst → vermutlich Konsolenmodus
+        DWORD err = GetLastError();
+        if (err == ERROR_FAILED_SERVICE_CONTROLLER_CONNECT) {
+            SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+            ProxyThread(NULL);
+            return 0;
+        } else {
+            log_efln("StartServiceCtrlDispatcher failed: %lu", err);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void WINAPI ServiceMain(DWORD argc, LPTSTR *argv) {
+    g_StatusHandle = RegisterServiceCtrlHandler(SERVICE_NAME, ServiceCtrlHandler);
+    g_StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    SetServiceStatus(g_StatusHandle, &(SERVICE_STATUS){SERVICE_WIN32_OWN_PROCESS, SERVICE_RUNNING,
+        SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_PARAMCHANGE});
+    CreateThread(NULL, 0, ProxyThread, NULL, 0, NULL);
+    WaitForSingleObject(g_StopEvent, INFINITE);
+    SetServiceStatus(g_StatusHandle, &(SERVICE_STATUS){SERVICE_WIN32_OWN_PROCESS, SERVICE_STOPPED});
+}
+
+/// @brief Console mode: Ctrl+Break dumps the capture ring, Ctrl+C ends the program
+BOOL WINAPI ConsoleCtrlHandler(DWORD ctrlType) {
+    if (ctrlType != CTRL_BREAK_EVENT)
+        return FALSE;
+    capture_dump("Ctrl+Break");
+    return TRUE;
+}
+
+void WINAPI ServiceCtrlHandler(DWORD ctrlCode) {
+    switch (ctrlCode) {
+        case CAPTURE_SERVICE_CONTROL:
+            capture_dump("service control");
+            break;
+
+        case SERVICE_CONTROL_PARAMCHANGE:
+            reload = TRUE;          // Applied by the accept loop
+            break;
+
+        case SERVICE_CONTROL_STOP:
+            stop = TRUE;            // Accept loop closes the listeners within a second
+            SetEvent(g_StopEvent);
+
+            SERVICE_STATUS status;
+            status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
+            status.dwCurrentState = SERVICE_STOP_PENDING;
+            status.dwControlsAccepted = 1;
+            status.dwWin32ExitCode = 0;
+            status.dwCheckPoint = 1;
+            status.dwWaitHint = 1000;
+            SetServiceStatus(g_StatusHandle, &status);
+    }
+}
+
+/// @brief Listening socket on port
+/// @return Socket or INVALID_SOCKET on error
+static SOCKET listen_on(int port) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) {
+        log_efln("Socket creation failed: %s", GetLastErrorString(FALSE));
+        return INVALID_SOCKET;
+    }
+    struct sockaddr_in addr = {AF_INET, htons(port), INADDR_ANY};
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        log_efln("Bind failed: %s", GetLastErrorString(FALSE));
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    // Above 200 only taken with the hint, room for all masters reconnecting at once
+    int backlog = config()->backlog;
+    u_long nonblocking = 1;
+    if (listen(sock, backlog > 200 ? SOMAXCONN_HINT(backlog) : backlog) == SOCKET_ERROR
+            || ioctlsocket(sock, FIONBIO, &nonblocking) == SOCKET_ERROR) {
+        log_efln("Listen failed: %s", GetLastErrorString(FALSE));;
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    log_fln("Listening on port %d...", port);
+    return sock;
+}
+
+/// @brief Open listeners of configured ports not listened on yet, close the ones no longer configured.
+/// @brief Masters accepted by a closed listener stay connected
+/// @return Number of ports that could not be opened
+static int listeners_update() {
+    const struct config* cfg = config();
+    int ports[1 + CONFIG_MAX_LISTENERS];
+    int port_count = 0;
+    ports[port_count++] = cfg->listen_port;
+    for (int i = 0; i < cfg->listen_count; i++)
+        ports[port_count++] = cfg->listen_ports[i];
+
+    for (int i = 0; i < listener_count; ) {
+        boolean configured = FALSE;
+        for (int j = 0; j < port_count && !configured; j++)
+            configured = ports[j] == listener_ports[i];
+        if (configured) {
+            i++;
+            continue;
+        }
+        log_fln("Listener on port %d closed", listener_ports[i]);
+        closesocket(listeners[i]);
+        listener_count--;
+        listeners[i] = listeners[listener_count];
+        listener_ports[i] = listener_ports[listener_count];
+    }
+
+    int failed = 0;
+    for (int j = 0; j < port_count; j++) {
+        boolean open = FALSE;
+        for (int i = 0; i < listener_count && !open; i++)
+            open = listener_ports[i] == ports[j];
+        if (open)
+            continue;
+        SOCKET sock = listen_on(ports[j]);
+        if (sock == INVALID_SOCKET) {
+            failed++;
+            continue;
+        }
+        listeners[listener_count] = sock;
+        listener_ports[listener_count++] = ports[j];
+    }
+    return failed;
+}
+
+/// @brief Swap in the reloaded settings: routes, targets and listeners follow, connections stay
+static void proxy_reload() {
+    if (config_reload())
+        return;
+    route_reload(!rtu_mode);
+    if (listeners_update() && !listener_count)
+        log_eln("No listener port could be opened, masters cannot connect until the next reload");
+}
+
+/// @brief Gateway: target, reactor threads and accept loop until service stop
+/// @return 0 if OK, 1 error
+static DWORD proxy_run() {
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2,2), &wsa);
+
+    rtu_mode = config()->rtu;
+    rtu_mode
+        ? log_ln("RTU over TCP <-> TCP")
+        : log_ln("TCP <-> RTU over TCP");
+
+    if (capture_start()) {
+        WSACleanup();
+        return 1;
+    }
+
+    // One shared connection per target, requests are queued on it by unit id
+    if (route_start(!rtu_mode)) {
+        WSACleanup();
+        return 1;
+    }
+    if (poll_start()) {
+        WSACleanup();
+        return 1;
+    }
+
+    // Fixed number of threads drives all master connections
+    if (reactor_start(0)) {
+        WSACleanup();
+        return 1;
+    }
+
+    if (config()->metrics_port)
+        metrics_start(config()->metrics_port);     // Gateway runs on without it
+
+    if (listeners_update()) {
+        for (int i = 0; i < listener_count; i++)
+            closesocket(listeners[i]);
+        listener_count = 0;
+        WSACleanup();
+        return 1;
+    }
+
+    // Masters on all listener ports go to the same reactors, the port can select their --priority
+    WSAPOLLFD fds[1 + CONFIG_MAX_LISTENERS];
+    uint64_t file_time = config_file_time();
+    uint64_t file_checked_us = time_us();
+    while (!stop) {
+        // Reload on service control paramchange or when the --config file was saved
+        if (time_us() - file_checked_us >= 1000000) {
+            file_checked_us = time_us();
+            uint64_t t = config_file_time();
+            if (t && t != file_time) {
+                file_time = t;
+                reload = TRUE;
+            }
+            config_reclaim();           // Snapshots replaced before, once all readers moved on
+        }
+        if (reload) {
+            reload = FALSE;
+            proxy_reload();
+        }
+
+        if (!listener_count) {
+            Sleep(100);                 // All ports failed on reload, WSAPoll would fail right away
+            continue;
+        }
+        for (int i = 0; i < listener_count; i++)
+            fds[i] = (WSAPOLLFD){ listeners[i], POLLRDNORM, 0 };
+        if (WSAPoll(fds, listener_count, 1000) == SOCKET_ERROR) {
+            if (!stop)
+                log_efln("WSAPoll(listener) failed: %s", GetLastErrorString(FALSE));
+            Sleep(10);
+            continue;
+        }
+        for (int i = 0; i < listener_count && !stop; i++) {
+            if (!fds[i].revents)
+                continue;
+            // Non-blocking listener: take what is pending in one go, bounded for the other listeners
+            for (int n = 0; n < ACCEPT_BATCH; n++) {
+                SOCKET client = accept(listeners[i], NULL, NULL);
+                if (client == INVALID_SOCKET) {
+                    if (WSAGetLastError() != WSAEWOULDBLOCK)
+                        log_efln("Accept failed: %s", GetLastErrorString(FALSE));
+                    break;
+                }
+                reactor_add(client, rtu_mode);
+            }
+        }
+    }
+
+    for (int i = 0; i < listener_count; i++)
+        closesocket(listeners[i]);
+    listener_count = 0;
+    WSACleanup();
+    return 0;
+}
+
+DWORD WINAPI ProxyThread(LPVOID lpParam) {
+    log_start();                // Console I/O off the connection threads
+    DWORD result = proxy_run();
+    log_stop();
+    return result;
+}
@@ -0,0 +1,263 @@
+/*
+ * File   : metrics.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the metrics endpoint. One thread accepts
+ *               scrapes one at a time, any GET gets the full exposition.
+ */
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+
+#include "main.h"
+#include "cli.h"
+#include "comm.h"
+#include "config.h"
+#include "target.h"
+#include "route.h"
+#include "poll.h"
+#include "reactor.h"
+
+#define METRICS_PREFIX  "modbus_gateway_"
+
+
+static SOCKET metrics_listener = INVALID_SOCKET;
+
+
+/// @brief Prometheus label of target
+static const char* target_labels(struct target* target, char* labels, size_t size) {
+    snprintf(labels, size, "target=\"%s:%d\"", target->host, target->port);
+    return labels;
+}
+
+/// @brief Round trip estimates (timeout FALSE) or response timeouts (TRUE) of target and its units
+static void metrics_write_rto(struct text* t, struct target* target, const char* name, boolean timeout) {
+    char labels[300];
+    target_labels(target, labels, sizeof(labels));
+    for (int unit = -1; unit < 256; unit++) {
+        const struct rto_estimator* e = unit < 0 ? &target->rto : &target->rto_units[unit];
+        if (!e->samples)
+            continue;
+        uint64_t us = timeout
+            ? (config()->timeout_ms ? config()->timeout_ms * 1000ULL : rto_timeout_us(e, RTO_REFERENCE_SIZE, 0))
+            : rto_srtt_us(e, RTO_REFERENCE_SIZE);
+        if (unit < 0)
+            text_printf(t, METRICS_PREFIX "%s{%s} %.6f\n", name, labels, us / 1e6);
+        else
+            text_printf(t, METRICS_PREFIX "%s{%s,unit=\"%d\"} %.6f\n", name, labels, unit, us / 1e6);
+    }
+}
+
+void metrics_write(struct text* t) {
+    char labels[300];
+    int count = route_target_count();
+
+    text_printf(t, "# HELP " METRICS_PREFIX "upstream_rtt_seconds Request sent to target until response received\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "upstream_rtt_seconds histogram\n");
+    for (int i = 0; i < count; i++)
+        stats_write_histogram(t, METRICS_PREFIX "upstream_rtt_seconds", target_labels(route_target_at(i), labels, sizeof(labels)), &route_target_at(i)->rtt);
+
+    text_printf(t, "# HELP " METRICS_PREFIX "rtt_estimate_seconds Smoothed round trip of a one register read (per target and unit id)\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "rtt_estimate_seconds gauge\n");
+    for (int i = 0; i < count; i++)
+        metrics_write_rto(t, route_target_at(i), "rtt_estimate_seconds", FALSE);
+    text_printf(t, "# HELP " METRICS_PREFIX "response_timeout_seconds Current response timeout of a one register read (per target and unit id)\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "response_timeout_seconds gauge\n");
+    for (int i = 0; i < count; i++)
+        metrics_write_rto(t, route_target_at(i), "response_timeout_seconds", TRUE);
+
+    text_printf(t, "# HELP " METRICS_PREFIX "queue_wait_seconds Queued in the gateway until taken by the target worker\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "queue_wait_seconds histogram\n");
+    for (int i = 0; i < count; i++)
+        stats_write_histogram(t, METRICS_PREFIX "queue_wait_seconds", target_labels(route_target_at(i), labels, sizeof(labels)), &route_target_at(i)->queue_wait);
+
+    text_printf(t, "# HELP " METRICS_PREFIX "class_queue_wait_seconds Queue wait per priority class of the masters (--priority)\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "class_queue_wait_seconds histogram\n");
+    for (int i = 0; i < count; i++) {
+        struct target* target = route_target_at(i);
+        for (int c = 0; c < CONFIG_PRIORITY_CLASSES; c++) {
+            if (!target->class_wait[c].count)
+                continue;
+            char class_labels[320];
+            snprintf(class_labels, sizeof(class_labels), "%s,class=\"%d\"", target_labels(target, labels, sizeof(labels)), c);
+            stats_write_histogram(t, METRICS_PREFIX "class_queue_wait_seconds", class_labels, &target->class_wait[c]);
+        }
+    }
+    text_printf(t, "# HELP " METRICS_PREFIX "dropped_total Requests dropped, still queued when their master gave up (--master-timeout)\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "dropped_total counter\n");
+    for (int i = 0; i < count; i++)
+        text_printf(t, METRICS_PREFIX "dropped_total{%s} %llu\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+            (unsigned long long)route_target_at(i)->dropped);
+    text_printf(t, "# HELP " METRICS_PREFIX "broadcasts_total Requests to unit 0, sent without waiting for a response\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "broadcasts_total counter\n");
+    for (int i = 0; i < count; i++)
+        text_printf(t, METRICS_PREFIX "broadcasts_total{%s} %llu\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+            (unsigned long long)route_target_at(i)->broadcasts);
+    text_printf(t, "# HELP " METRICS_PREFIX "split_reads_total Reads above --max-quantity, sent as several requests and joined\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "split_reads_total counter\n");
+    for (int i = 0; i < count; i++)
+        text_printf(t, METRICS_PREFIX "split_reads_total{%s} %lld\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+            (long long)route_target_at(i)->splits);
+    text_printf(t, "# HELP " METRICS_PREFIX "bus_busy_seconds_total Serial line behind the target occupied: request until the line is free again (--baud), rate() is the utilization\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "bus_busy_seconds_total counter\n");
+    for (int i = 0; i < count; i++)
+        if (route_target_at(i)->char_ns)
+            text_printf(t, METRICS_PREFIX "bus_busy_seconds_total{%s} %.6f\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+                route_target_at(i)->bus_busy_us / 1e6);
+    text_printf(t, "# HELP " METRICS_PREFIX "bus_wire_seconds_total Characters of requests and responses on the serial line (--baud)\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "bus_wire_seconds_total counter\n");
+    for (int i = 0; i < count; i++)
+        if (route_target_at(i)->char_ns)
+            text_printf(t, METRICS_PREFIX "bus_wire_seconds_total{%s} %.6f\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+                route_target_at(i)->bus_wire_us / 1e6);
+
+    text_printf(t, "# HELP " METRICS_PREFIX "target_errors_total Error events on the upstream connection\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "target_errors_total counter\n");
+    for (int i = 0; i < count; i++)
+        stats_write_errors(t, METRICS_PREFIX "target_errors_total", target_labels(route_target_at(i), labels, sizeof(labels)), &route_target_at(i)->errors);
+
+    text_printf(t, "# HELP " METRICS_PREFIX "transactions_total Transactions taken by the target worker\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "transactions_total counter\n");
+    for (int i = 0; i < count; i++)
+        text_printf(t, METRICS_PREFIX "transactions_total{%s} %llu\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+            (unsigned long long)route_target_at(i)->transactions);
+    text_printf(t, "# HELP " METRICS_PREFIX "coalesced_total Transactions answered by another one's covering read\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "coalesced_total counter\n");
+    for (int i = 0; i < count; i++)
+        text_printf(t, METRICS_PREFIX "coalesced_total{%s} %llu\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+            (unsigned long long)route_target_at(i)->coalesced);
+    text_printf(t, "# HELP " METRICS_PREFIX "queue_depth Transactions waiting for the target worker\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "queue_depth gauge\n");
+    for (int i = 0; i < count; i++)
+        text_printf(t, METRICS_PREFIX "queue_depth{%s} %ld\n", target_labels(route_target_at(i), labels, sizeof(labels)),
+            route_target_at(i)->queue_depth);
+    if (config()->cache_ttl_ms > 0 || config()->cache_rule_count > 0) {
+        text_printf(t, "# HELP " METRICS_PREFIX "cache_lookups_total Response cache lookups of reads\n");
+        text_printf(t, "# TYPE " METRICS_PREFIX "cache_lookups_total counter\n");
+        for (int i = 0; i < count; i++) {
+            struct target* target = route_target_at(i);
+            if (!target->cache)
+                continue;           // Caching configured by a reload, cache creation failed
+            target_labels(target, labels, sizeof(labels));
+            text_printf(t, METRICS_PREFIX "cache_lookups_total{%s,result=\"hit\"} %lld\n", labels, (long long)target->cache->hits);
+            text_printf(t, METRICS_PREFIX "cache_lookups_total{%s,result=\"miss\"} %lld\n", labels, (long long)target->cache->misses);
+        }
+    }
+
+    struct histogram turnaround = {0};
+    struct histogram first_response = {0};
+    struct error_counters errors = {0};
+    reactor_metrics(&turnaround, &first_response, &errors);
+    text_printf(t, "# HELP " METRICS_PREFIX "turnaround_seconds Request received from master until response sent\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "turnaround_seconds histogram\n");
+    stats_write_histogram(t, METRICS_PREFIX "turnaround_seconds", "", &turnaround);
+    text_printf(t, "# HELP " METRICS_PREFIX "first_response_seconds Master connection accepted until its first response sent\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "first_response_seconds histogram\n");
+    stats_write_histogram(t, METRICS_PREFIX "first_response_seconds", "", &first_response);
+    text_printf(t, "# HELP " METRICS_PREFIX "master_errors_total Error events on master connections\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "master_errors_total counter\n");
+    stats_write_errors(t, METRICS_PREFIX "master_errors_total", "", &errors);
+    text_printf(t, "# HELP " METRICS_PREFIX "master_connections Connected masters\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "master_connections gauge\n");
+    text_printf(t, METRICS_PREFIX "master_connections %d\n", reactor_connections());
+    text_printf(t, "# HELP " METRICS_PREFIX "master_rejected_total Masters closed right away at the connection limit\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "master_rejected_total counter\n");
+    text_printf(t, METRICS_PREFIX "master_rejected_total %llu\n", (unsigned long long)reactor_rejected());
+
+    if (config()->poll_count) {
+        text_printf(t, "# HELP " METRICS_PREFIX "image_reads_total Master reads answered from the polled image\n");
+        text_printf(t, "# TYPE " METRICS_PREFIX "image_reads_total counter\n");
+        text_printf(t, METRICS_PREFIX "image_reads_total %lld\n", (long long)poll_counters.reads);
+        text_printf(t, "# HELP " METRICS_PREFIX "polls_total Poll requests of the data concentrator\n");
+        text_printf(t, "# TYPE " METRICS_PREFIX "polls_total counter\n");
+        text_printf(t, METRICS_PREFIX "polls_total{result=\"ok\"} %lld\n", (long long)(poll_counters.polls - poll_counters.errors));
+        text_printf(t, METRICS_PREFIX "polls_total{result=\"error\"} %lld\n", (long long)poll_counters.errors);
+    }
+
+    text_printf(t, "# HELP " METRICS_PREFIX "bytes_copied_total Frame bytes moved between buffers\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "bytes_copied_total counter\n");
+    text_printf(t, METRICS_PREFIX "bytes_copied_total %lld\n", (long long)io_counters.bytes_copied);
+    text_printf(t, "# HELP " METRICS_PREFIX "socket_calls_total send/recv calls on master and target sockets\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "socket_calls_total counter\n");
+    text_printf(t, METRICS_PREFIX "socket_calls_total %lld\n", (long long)io_counters.syscalls);
+
+    text_printf(t, "# HELP " METRICS_PREFIX "log_dropped_total Log lines dropped because a log ring was full\n");
+    text_printf(t, "# TYPE " METRICS_PREFIX "log_dropped_total counter\n");
+    text_printf(t, METRICS_PREFIX "log_dropped_total %lld\n", log_dropped());
+}
+
+/// @brief Answer one scrape
+static void metrics_serve(SOCKET client) {
+    char request[1024];
+    int len = 0;
+
+    // Read the request head, its content does not matter
+    DWORD timeout = TCP_TIMEOUT;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    while (len < (int)sizeof(request) -1) {
+        int n = recv(client, request + len, sizeof(request) -1 - len, 0);
+        if (n <= 0)
+            return;
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n"))
+            break;
+    }
+
+    struct text body = {0};
+    metrics_write(&body);
+    char head[200];
+    int head_len = snprintf(head, sizeof(head),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        body.len);
+    WSABUF bufs[2] = { { head_len, head }, { (u_long)body.len, body.data } };
+    send_gather(client, bufs, body.data ? 2 : 1);
+    free(body.data);
+}
+
+static DWORD WINAPI metrics_thread(LPVOID lpParam) {
+    int reader = config_reader_register();
+    while (!isStop()) {
+        config_offline(reader);         // Waits for the next scrape
+        SOCKET client = accept(metrics_listener, NULL, NULL);
+        config_quiescent(reader);
+        if (client == INVALID_SOCKET) {
+            if (!isStop())
+                log_efln("Metrics accept failed: %s", GetLastErrorString(FALSE));
+            Sleep(100);
+            continue;
+        }
+        metrics_serve(client);
+        closesocket(client);
+    }
+    config_reader_unregister(reader);
+    return 0;
+}
+
+int metrics_start(int port) {
+    metrics_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr = {AF_INET, htons(port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (metrics_listener == INVALID_SOCKET
+            || bind(metrics_listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR
+            || listen(metrics_listener, 5) == SOCKET_ERROR) {
+        log_efln("Metrics endpoint on port %d failed: %s", port, GetLastErrorString(FALSE));
+        if (metrics_listener != INVALID_SOCKET)
+            closesocket(metrics_listener);
+        metrics_listener = INVALID_SOCKET;
+        return -1;
+    }
+    if (!CreateThread(NULL, 0, metrics_thread, NULL, 0, NULL)) {
+        log_efln("Metrics CreateThread failed: %lu", GetLastError());
+        closesocket(metrics_listener);
+        metrics_listener = INVALID_SOCKET;
+        return -1;
+    }
+    log_fln("Metrics on http://127.0.0.1:%d/metrics", port);
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * File   : metrics.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the metrics endpoint, a minimal HTTP server
+ *               on the loopback interface serving the counters and latency
+ *               histograms in Prometheus text format
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "stats.h"
+
+
+/// @brief Start metrics endpoint thread
+/// @param port Port on 127.0.0.1
+/// @return 0 if OK, <0 error
+int metrics_start(int port);
+
+/// @brief Write all metrics in Prometheus text format
+/// @param t Text buffer
+void metrics_write(struct text* t);
+
+#endif
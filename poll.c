@@ -0,0 +1,334 @@
+/*
+ * File   : poll.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the data concentrator. One thread queues
+ *               the due blocks at their targets like a master would, the
+ *               completion (target worker) stores the response as the block's
+ *               image. Reactor threads read the image under a shared lock,
+ *               every update is also published to the shared-memory image.
+ */
+
+#include "poll.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "cli.h"
+#include "comm.h"
+#include "config.h"
+#include "endian.h"
+#include "route.h"
+#include "target.h"
+#include "image.h"
+
+#define POLL_IDLE_MS    100         // Max sleep of the poll thread
+
+
+/// @brief One polled read, at most one PDU
+struct poll_block {
+    uint8_t unit;
+    uint8_t function_code;          // 0x01-0x04
+    uint16_t address;
+    uint32_t quantity;
+    uint64_t interval_us;
+    volatile LONG64 next_us;        // Next poll, 0 as soon as possible
+    volatile LONG in_flight;
+    LONG polled_writes;             // writes when the poll was submitted
+
+    struct transaction tx;
+    uint8_t req[6];
+
+    SRWLOCK lock;                   // Image: rsp, rsp_len, updated_us, writes
+    volatile LONG writes;           // Writes of masters applied by poll_written
+    uint8_t rsp[BUFFER_SIZE];       // Last response (unit id + PDU)
+    int rsp_len;                    // 0 no valid data
+    uint64_t updated_us;
+};
+
+struct poll_counters poll_counters = {0};
+
+static struct poll_block* blocks = NULL;
+static int block_count = 0;
+
+
+/// @brief Order for merging: unit, function code, interval, address
+static int poll_rule_compare(const void* a, const void* b) {
+    const struct poll_rule* x = a;
+    const struct poll_rule* y = b;
+    if (x->unit != y->unit)
+        return x->unit - y->unit;
+    if (x->function_code != y->function_code)
+        return x->function_code - y->function_code;
+    if (x->interval_ms != y->interval_ms)
+        return x->interval_ms - y->interval_ms;
+    return x->address - y->address;
+}
+
+/// @brief Append block for range, split at the PDU limit
+static int poll_add_blocks(const struct poll_rule* rule, uint32_t end, int capacity) {
+    uint32_t max = read_max_quantity(rule->function_code);
+    for (uint32_t address = rule->address; address < end; address += max) {
+        if (block_count >= capacity)
+            return -1;
+        struct poll_block* b = &blocks[block_count++];
+        b->unit = rule->unit;
+        b->function_code = rule->function_code;
+        b->address = address;
+        b->quantity = end - address < max ? end - address : max;
+        b->interval_us = rule->interval_ms * 1000ULL;
+        b->req[0] = b->unit;
+        b->req[1] = b->function_code;
+        b->req[2] = address >> 8;
+        b->req[3] = address & 0xFF;
+        b->req[4] = b->quantity >> 8;
+        b->req[5] = b->quantity & 0xFF;
+        b->tx.req = b->req;
+        b->tx.req_len = sizeof(b->req);
+        b->tx.context = b;
+        InitializeSRWLock(&b->lock);
+    }
+    return 0;
+}
+
+/// @brief Copy the block to the shared-memory image (block lock held exclusively)
+static void poll_publish(struct poll_block* b) {
+    image_publish((int)(b - blocks), b->rsp, b->rsp_len, b->updated_us);
+}
+
+/// @brief Store poll response as image of the block (target worker thread)
+static void poll_done(struct transaction* tx) {
+    struct poll_block* b = tx->context;
+    boolean valid = tx->rsp_len == 1 + expected_pdu_length(b->function_code, b->quantity)
+        && tx->rsp[1] == b->function_code;
+
+    AcquireSRWLockExclusive(&b->lock);
+    if (b->writes != b->polled_writes) {
+        // A write completed while the poll was in flight, an out-of-order target may have answered
+        // the poll with data from before it: keep the written image and poll again right away
+        ReleaseSRWLockExclusive(&b->lock);
+        InterlockedExchange64(&b->next_us, 0);
+        InterlockedExchange(&b->in_flight, 0);
+        return;
+    }
+    if (valid) {
+        memcpy(b->rsp, tx->rsp, tx->rsp_len);
+        b->updated_us = time_us();
+    } else if (b->rsp_len) {
+        log_efln("Poll of unit %u fc 0x%02X %u+%u failed (%d), masters read from the target",
+            b->unit, b->function_code, b->address, b->quantity, tx->rsp_len > 0 ? tx->rsp[2] : tx->rsp_len);
+    }
+    b->rsp_len = valid ? tx->rsp_len : 0;
+    poll_publish(b);
+    ReleaseSRWLockExclusive(&b->lock);
+
+    InterlockedIncrement64(&poll_counters.polls);
+    if (!valid)
+        InterlockedIncrement64(&poll_counters.errors);
+    InterlockedExchange(&b->in_flight, 0);
+}
+
+static DWORD WINAPI poll_thread(LPVOID lpParam) {
+    int reader = config_reader_register();
+    while (!isStop()) {
+        config_quiescent(reader);
+        uint64_t now = time_us();
+        uint64_t wait_us = POLL_IDLE_MS * 1000ULL;
+        for (int i = 0; i < block_count; i++) {
+            struct poll_block* b = &blocks[i];
+            if (b->in_flight)
+                continue;
+            if ((uint64_t)b->next_us <= now) {
+                // Keep the phase of the schedule unless the poll is overdue
+                uint64_t next = (uint64_t)b->next_us + b->interval_us;
+                InterlockedExchange64(&b->next_us, next > now ? next : now + b->interval_us);
+                InterlockedExchange(&b->in_flight, 1);
+                b->polled_writes = b->writes;
+                b->tx.done = poll_done;
+                target_submit(route_target(b->unit), &b->tx);
+            }
+            uint64_t due = (uint64_t)b->next_us > now ? (uint64_t)b->next_us - now : 0;
+            if (due < wait_us)
+                wait_us = due;
+        }
+        config_offline(reader);         // Intervals can be long, reloads are not held back
+        Sleep((DWORD)((wait_us + 999) / 1000));
+    }
+    config_reader_unregister(reader);
+    return 0;
+}
+
+int poll_start() {
+    int count = config()->poll_count;
+    if (!count) {
+        if (image_start(0))         // Only the ranges masters read
+            return -1;
+        image_activate();
+        return 0;
+    }
+
+    struct poll_rule rules[CONFIG_MAX_POLLS];
+    memcpy(rules, config()->polls, count * sizeof(struct poll_rule));
+    qsort(rules, count, sizeof(struct poll_rule), poll_rule_compare);
+
+    // Worst case every rule is split into full PDUs
+    int capacity = 0;
+    for (int i = 0; i < count; i++)
+        capacity += (rules[i].quantity + read_max_quantity(rules[i].function_code) -1) / read_max_quantity(rules[i].function_code);
+    blocks = calloc(capacity, sizeof(struct poll_block));
+    if (!blocks) {
+        log_efln("poll_start malloc failed: %s", GetLastErrorString(FALSE));
+        return -1;
+    }
+
+    // Merge overlapping/adjacent ranges polled at the same interval, then split them into PDUs
+    for (int i = 0; i < count; ) {
+        struct poll_rule merged = rules[i];
+        uint32_t end = merged.address + merged.quantity;
+        for (i++; i < count && rules[i].unit == merged.unit && rules[i].function_code == merged.function_code
+                && rules[i].interval_ms == merged.interval_ms && rules[i].address <= (int)end; i++) {
+            if ((uint32_t)(rules[i].address + rules[i].quantity) > end)
+                end = rules[i].address + rules[i].quantity;
+        }
+        if (poll_add_blocks(&merged, end, capacity))
+            return -1;
+    }
+
+    if (image_start(block_count))
+        return -1;
+    for (int i = 0; i < block_count; i++)
+        image_describe(i, blocks[i].unit, blocks[i].function_code, blocks[i].address, (uint16_t)blocks[i].quantity,
+            (int)(blocks[i].interval_us / 1000));
+    image_activate();
+
+    HANDLE thread = CreateThread(NULL, 0, poll_thread, NULL, 0, NULL);
+    if (!thread) {
+        log_efln("poll_start CreateThread failed: %lu", GetLastError());
+        return -1;
+    }
+    CloseHandle(thread);
+    log_fln("Polling %d blocks for %d --poll ranges", block_count, count);
+    return 0;
+}
+
+/// @brief Fresh block of unit and function code containing address, shared lock held on return
+static struct poll_block* poll_find(uint8_t unit, uint8_t function_code, uint32_t address, uint64_t now) {
+    for (int i = 0; i < block_count; i++) {
+        struct poll_block* b = &blocks[i];
+        if (b->unit != unit || b->function_code != function_code
+                || address < b->address || address >= b->address + b->quantity)
+            continue;
+        AcquireSRWLockShared(&b->lock);
+        if (b->rsp_len && now - b->updated_us <= POLL_MAX_AGE_FACTOR * b->interval_us)
+            return b;
+        ReleaseSRWLockShared(&b->lock);
+    }
+    return NULL;
+}
+
+int poll_lookup(const uint8_t* req, int req_len, uint8_t* rsp) {
+    if (!block_count || req_len != 6 || !read_max_quantity(req[1]))
+        return 0;
+    uint8_t function_code = req[1];
+    uint32_t address = read_uint16_reverse(req +2);
+    uint32_t quantity = read_uint16_reverse(req +4);
+    uint32_t end = address + quantity;
+    if (quantity < 1 || quantity > (uint32_t)read_max_quantity(function_code))
+        return 0;                   // Let the target answer with its exception
+
+    int pdu_len = expected_pdu_length(function_code, quantity);
+    rsp[0] = req[0];
+    rsp[1] = function_code;
+    rsp[2] = pdu_len -2;
+    memset(rsp +3, 0, pdu_len -2);
+
+    // A read may span several blocks
+    uint64_t now = time_us();
+    for (uint32_t a = address; a < end; ) {
+        struct poll_block* b = poll_find(req[0], function_code, a, now);
+        if (!b)
+            return 0;
+        uint32_t part_end = b->address + b->quantity < end ? b->address + b->quantity : end;
+        if (function_code == 0x03 || function_code == 0x04) {
+            memcpy(rsp +3 + (a - address)*2, b->rsp +3 + (a - b->address)*2, (part_end - a)*2);
+        } else {
+            for (; a < part_end; a++) {
+                uint32_t bit = a - b->address;
+                uint32_t i = a - address;
+                if (b->rsp[3 + bit/8] & (1 << (bit%8)))
+                    rsp[3 + i/8] |= 1 << (i%8);
+            }
+        }
+        a = part_end;
+        ReleaseSRWLockShared(&b->lock);
+    }
+    InterlockedIncrement64(&poll_counters.reads);
+    return 1 + pdu_len;
+}
+
+void poll_written(const uint8_t* req, int req_len, const uint8_t* rsp, int rsp_len) {
+    boolean broadcast = rsp_len == enSIMPLE_TCP_broadcast;
+    if (!block_count || req_len < 6 || (!broadcast && (rsp_len <= 0 || (rsp[1] & 0x80))))
+        return;
+    uint8_t function_code = req[1];
+    uint32_t address = read_uint16_reverse(req +2);
+    uint32_t quantity;
+    uint8_t image_fc;
+
+    switch (function_code) {
+        case 0x05: image_fc = 0x01; quantity = 1; break;
+        case 0x06: image_fc = 0x03; quantity = 1; break;
+        case 0x0F: image_fc = 0x01; quantity = read_uint16_reverse(req +4); break;
+        case 0x10: image_fc = 0x03; quantity = read_uint16_reverse(req +4); break;
+        case 0x16: case 0x17: image_fc = 0x03; quantity = 0; break;
+        default: return;
+    }
+    if ((function_code == 0x0F || function_code == 0x10) && req_len < 7 + req[6])
+        return;
+
+    for (int i = 0; i < block_count; i++) {
+        struct poll_block* b = &blocks[i];
+        if ((b->unit != req[0] && !broadcast) || b->function_code != image_fc)
+            continue;
+        if (!quantity || broadcast) {
+            // Mask write / read-write, or broadcast nobody confirmed: result unknown, drop and poll again
+            uint32_t write_address = function_code == 0x17 ? read_uint16_reverse(req +6) : address;
+            uint32_t write_quantity = quantity ? quantity : function_code == 0x17 ? read_uint16_reverse(req +8) : 1;
+            if (write_address < b->address + b->quantity && b->address < write_address + write_quantity) {
+                AcquireSRWLockExclusive(&b->lock);
+                b->rsp_len = 0;
+                b->writes++;
+                poll_publish(b);
+                ReleaseSRWLockExclusive(&b->lock);
+                InterlockedExchange64(&b->next_us, 0);
+            }
+            continue;
+        }
+        if (address >= b->address + b->quantity || b->address >= address + quantity)
+            continue;
+
+        uint32_t start = address > b->address ? address : b->address;
+        uint32_t end = address + quantity < b->address + b->quantity ? address + quantity : b->address + b->quantity;
+        AcquireSRWLockExclusive(&b->lock);
+        b->writes++;
+        for (uint32_t a = start; a < end && b->rsp_len; a++) {
+            uint32_t at = a - b->address;
+            uint32_t from = a - address;
+            if (image_fc == 0x03) {
+                const uint8_t* value = function_code == 0x06 ? req +4 : req +7 + from*2;
+                b->rsp[3 + at*2] = value[0];
+                b->rsp[4 + at*2] = value[1];
+            } else {
+                boolean on = function_code == 0x05 ? req[4] == 0xFF : (req[7 + from/8] >> (from%8)) & 1;
+                if (on)
+                    b->rsp[3 + at/8] |= 1 << (at%8);
+                else
+                    b->rsp[3 + at/8] &= ~(1 << (at%8));
+            }
+        }
+        poll_publish(b);
+        ReleaseSRWLockExclusive(&b->lock);
+    }
+}
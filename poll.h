@@ -0,0 +1,51 @@
+/*
+ * File   : poll.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the data concentrator. Configured register
+ *               blocks (--poll) are read from the targets on a schedule into
+ *               an in-memory image, master reads inside the blocks are
+ *               answered from the image without a bus round trip.
+ */
+
+#ifndef __POLL_H__
+#define __POLL_H__
+
+#include <stdint.h>
+#include <windows.h>
+
+#define POLL_MAX_AGE_FACTOR 3       // Image data older than this many intervals is not served
+
+
+/// @brief Counters of the data concentrator
+struct poll_counters {
+    volatile LONG64 reads;          // Master reads answered from the image
+    volatile LONG64 polls;          // Poll requests completed
+    volatile LONG64 errors;         // Poll requests failed (error or exception response)
+};
+extern struct poll_counters poll_counters;
+
+
+/// @brief Build the blocks of all --poll options (merged, split at the PDU limit) and start polling
+/// @return 0 if OK (also without blocks), -1 error
+int poll_start();
+
+/// @brief Answer a read request from the image
+/// @param req Request (unit id + PDU)
+/// @param req_len Length of request
+/// @param rsp Buffer for response (BUFFER_SIZE)
+/// @return >0 Length of response, 0 not (completely) in the image or data too old
+int poll_lookup(const uint8_t* req, int req_len, uint8_t* rsp);
+
+/// @brief Apply a successful write (0x05, 0x06, 0x0F, 0x10) to the image,
+/// @brief other writes (0x16, 0x17) mark the affected blocks for an immediate poll
+/// @brief A broadcast (unit 0) marks the affected blocks of all units for an immediate poll
+/// @brief A poll of an affected block in flight meanwhile is dropped and repeated
+/// @param req Request (unit id + PDU)
+/// @param req_len Length of request
+/// @param rsp Response (unit id + PDU)
+/// @param rsp_len Length of response, <=0 error (enSIMPLE_TCP_broadcast: sent as broadcast)
+void poll_written(const uint8_t* req, int req_len, const uint8_t* rsp, int rsp_len);
+
+#endif
@@ -0,0 +1,595 @@
+/*
+ * File   : reactor.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the event driven master connection handling.
+ *               Master sockets are non-blocking and polled with WSAPoll by a
+ *               fixed number of reactor threads. Requests are handed to the
+ *               target queue, the completion wakes the reactor again.
+ *               Connection state comes from a slab, the I/O buffers are lent
+ *               from a per-reactor pool only while a request is active.
+ */
+
+#include "reactor.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "cli.h"
+#include "crc.h"
+#include "endian.h"
+#include "frame.h"
+#include "route.h"
+#include "poll.h"
+#include "config.h"
+#include "capture.h"
+
+
+#define REACTOR_POLL_TIMEOUT    1000
+#define REACTOR_MAX_THREADS     64
+#define STATS_INTERVAL_US       (60 * 1000000ULL)
+#define CONN_SLAB               64      // Connections allocated at once
+#define REACTOR_IO_SPARE        64      // Buffers kept in the pool of a reactor, more are freed
+
+
+static struct reactor* reactors[REACTOR_MAX_THREADS];
+static int reactor_count = 0;
+static volatile LONG reactor_next = 0;
+static volatile LONG conn_count = 0;            // Master connections handed to reactors, not yet closed
+static volatile LONG64 conns_rejected = 0;      // Closed right away (--max-connections)
+static uint64_t rejected_logged_us = 0;         // Accept thread only
+static CRITICAL_SECTION slab_lock;
+static struct conn* slab_free = NULL;           // Free connection states of all slabs (slab_lock)
+
+
+static DWORD WINAPI reactor_thread(LPVOID lpParam);
+static void conn_process(struct conn* c);
+
+
+/// @brief Connection state out of the slab, grows by CONN_SLAB at a time (any thread)
+/// @return Zeroed connection or NULL if out of memory
+static struct conn* conn_alloc() {
+    EnterCriticalSection(&slab_lock);
+    if (!slab_free) {
+        struct conn* slab = malloc(CONN_SLAB * sizeof(struct conn));
+        for (int i = 0; slab && i < CONN_SLAB; i++) {
+            slab[i].next = slab_free;
+            slab_free = &slab[i];
+        }
+    }
+    struct conn* c = slab_free;
+    if (c)
+        slab_free = c->next;
+    LeaveCriticalSection(&slab_lock);
+    if (c)
+        memset(c, 0, sizeof(struct conn));
+    return c;
+}
+
+/// @brief Return connection state to the slab, slabs stay allocated for the next masters
+static void conn_free(struct conn* c) {
+    EnterCriticalSection(&slab_lock);
+    c->next = slab_free;
+    slab_free = c;
+    LeaveCriticalSection(&slab_lock);
+}
+
+/// @brief Lend buffers to connection (reactor thread)
+/// @return 0 if OK, -1 out of memory
+static int conn_io_lend(struct conn* c) {
+    struct reactor* r = c->reactor;
+    struct conn_io* io = r->io_pool;
+    if (io) {
+        r->io_pool = io->next;
+        r->io_pool_count--;
+    } else if (!(io = malloc(sizeof(struct conn_io)))) {
+        log_efln("Master buffer malloc failed: %s", GetLastErrorString(FALSE));
+        return -1;
+    }
+    io->in_len = 0;
+    io->in_frame_len = 0;
+    io->out_count = 0;
+    io->tx.done = NULL;
+    io->tx.flow = &c->flow;
+    c->io = io;
+    return 0;
+}
+
+/// @brief Give buffers back, nothing buffered or in flight (reactor thread)
+static void conn_io_return(struct conn* c) {
+    struct reactor* r = c->reactor;
+    struct conn_io* io = c->io;
+    c->io = NULL;
+    if (r->io_pool_count >= REACTOR_IO_SPARE) {
+        free(io);
+        return;
+    }
+    io->next = r->io_pool;
+    r->io_pool = io;
+    r->io_pool_count++;
+}
+
+
+/// @brief Interrupt WSAPoll of reactor, callable from any thread
+static void reactor_wake(struct reactor* r) {
+    if (InterlockedExchange(&r->wake_pending, 1))
+        return;                 // Reactor not yet through its lists, it will see the new entry
+    char b = 0;
+    sendto(r->wake, &b, 1, 0, (struct sockaddr*)&r->wake_addr, sizeof(r->wake_addr));
+}
+
+static struct reactor* reactor_create() {
+    struct reactor* r = calloc(1, sizeof(struct reactor));
+    if (!r)
+        return NULL;
+    InitializeCriticalSection(&r->lock);
+    r->stats_logged_us = time_us();
+
+    r->wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    r->wake_addr.sin_family = AF_INET;
+    r->wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int addr_len = sizeof(r->wake_addr);
+    u_long nonblocking = 1;
+    if (r->wake == INVALID_SOCKET
+            || bind(r->wake, (struct sockaddr*)&r->wake_addr, sizeof(r->wake_addr)) == SOCKET_ERROR
+            || getsockname(r->wake, (struct sockaddr*)&r->wake_addr, &addr_len) == SOCKET_ERROR
+            || ioctlsocket(r->wake, FIONBIO, &nonblocking) == SOCKET_ERROR) {
+        log_efln("Reactor wake socket failed: %s", GetLastErrorString(FALSE));
+        if (r->wake != INVALID_SOCKET)
+            closesocket(r->wake);
+        DeleteCriticalSection(&r->lock);
+        free(r);
+        return NULL;
+    }
+
+    r->thread = CreateThread(NULL, 0, reactor_thread, r, 0, NULL);
+    if (!r->thread) {
+        log_efln("Reactor CreateThread failed: %lu", GetLastError());
+        closesocket(r->wake);
+        DeleteCriticalSection(&r->lock);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+int reactor_start(int threads) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if (threads <= 0)
+        threads = info.dwNumberOfProcessors;
+    if (threads > REACTOR_MAX_THREADS)
+        threads = REACTOR_MAX_THREADS;
+    boolean pin = threads <= (int)info.dwNumberOfProcessors && info.dwNumberOfProcessors <= 8 * sizeof(DWORD_PTR);
+    InitializeCriticalSection(&slab_lock);
+
+    // All threads up front, each one stays on its own processor with its connections (warm caches)
+    for (reactor_count = 0; reactor_count < threads; reactor_count++) {
+        reactors[reactor_count] = reactor_create();
+        if (!reactors[reactor_count])
+            return -1;
+        if (pin)
+            SetThreadAffinityMask(reactors[reactor_count]->thread, (DWORD_PTR)1 << reactor_count);
+    }
+    log_fln("%d reactor threads started%s", reactor_count, pin ? ", pinned to one processor each" : "");
+    return 0;
+}
+
+void reactor_add(SOCKET master, boolean rtu) {
+    uint64_t accepted_us = time_us();
+    int max_connections = config()->max_connections;
+    if (max_connections && conn_count >= max_connections) {
+        // Orderly close, the master retries instead of waiting in the backlog
+        closesocket(master);
+        LONG64 rejected = InterlockedIncrement64(&conns_rejected);
+        if (accepted_us - rejected_logged_us >= 1000000) {
+            rejected_logged_us = accepted_us;
+            log_wfln("Connection limit %d reached, %lld masters rejected so far", max_connections, (long long)rejected);
+        }
+        return;
+    }
+
+    struct conn* c = conn_alloc();
+    if (!c) {
+        log_efln("Master connection setup failed: %s", GetLastErrorString(FALSE));
+        closesocket(master);
+        return;
+    }
+    InterlockedIncrement(&conn_count);
+    c->sock = master;
+    c->rtu = rtu;
+    c->accepted_us = accepted_us;
+    c->state = enCONN_reading;
+
+    // Socket options and addresses are set up by the reactor, the accept thread only accepts
+    struct reactor* r = reactors[(ULONG)InterlockedIncrement(&reactor_next) % reactor_count];
+    c->reactor = r;
+    EnterCriticalSection(&r->lock);
+    c->next = r->added;
+    r->added = c;
+    LeaveCriticalSection(&r->lock);
+    reactor_wake(r);
+}
+
+int reactor_connections() { return conn_count; }
+
+uint64_t reactor_rejected() { return (uint64_t)conns_rejected; }
+
+/// @brief Set up new master connection in its reactor thread
+/// @return 0 if OK, -1 error (socket closed and connection freed)
+static int conn_setup(struct conn* c) {
+    SOCKET master = c->sock;
+    if (setSocketKeepAlive(master, TRUE))
+        log_efln("Error setSocketKeepAlive(master) %s", GetLastErrorString(FALSE));
+    BOOL nodelay = TRUE;        // Responses to batched requests go out back to back
+    if (setsockopt(master, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay)))
+        log_efln("Error setsockopt(master, nodelay) %s", GetLastErrorString(FALSE));
+    u_long nonblocking = 1;
+    if (ioctlsocket(master, FIONBIO, &nonblocking) == SOCKET_ERROR) {
+        log_efln("Master connection setup failed: %s", GetLastErrorString(FALSE));
+        closesocket(master);
+        conn_free(c);
+        InterlockedDecrement(&conn_count);
+        return -1;
+    }
+
+    // Priority class and weight by source address or the listener port connected to
+    struct sockaddr_in peer = {0}, local = {0};
+    int addr_len = sizeof(peer);
+    getpeername(master, (struct sockaddr*)&peer, &addr_len);
+    addr_len = sizeof(local);
+    getsockname(master, (struct sockaddr*)&local, &addr_len);
+    config_priority(ntohl(peer.sin_addr.s_addr), ntohs(local.sin_port), &c->flow.priority, &c->flow.weight);
+    snprintf(c->peer, sizeof(c->peer), "%s:%u", inet_ntoa(peer.sin_addr), ntohs(peer.sin_port));
+    c->capture_id = capture_conn_id();
+    log_sfln("New Master client connected (%s)", c->peer);
+    return 0;
+}
+
+
+
+void reactor_metrics(struct histogram* turnaround, struct histogram* first_response, struct error_counters* errors) {
+    for (int i = 0; i < reactor_count; i++) {
+        histogram_add(turnaround, &reactors[i]->turnaround);
+        histogram_add(first_response, &reactors[i]->first_response);
+        error_counters_add(errors, &reactors[i]->errors);
+    }
+}
+
+
+
+/// @brief Log requests and queueing delay of master (when it disconnects)
+static void conn_log_stats(struct conn* c) {
+    const struct histogram* h = &c->flow.queue_wait;
+    if (!h->count && !c->flow.dropped)
+        return;
+    log_ifln("Master %s (class %d, weight %d): %llu requests queued, wait p50 %llu us, p99 %llu us, max %llu us, %llu dropped",
+        c->peer, c->flow.priority, c->flow.weight, (unsigned long long)h->count,
+        (unsigned long long)histogram_percentile(h, 0.5), (unsigned long long)histogram_percentile(h, 0.99),
+        (unsigned long long)histogram_percentile(h, 1.0), (unsigned long long)c->flow.dropped);
+}
+
+/// @brief Log requests and queueing delay of the interval, one line per priority class, and start the next
+/// @brief interval: a line per master would overflow the log ring of the thread with hundreds of masters
+static void reactor_log_stats(struct reactor* r) {
+    uint64_t now = time_us();
+    for (int p = 0; p < CONFIG_PRIORITY_CLASSES; p++) {
+        const struct histogram* h = &r->class_wait[p];
+        if (!h->count && !r->class_dropped[p])
+            continue;
+        int masters = 0;
+        for (int i = 0; i < r->count; i++)
+            if (r->conns[i]->flow.priority == p)
+                masters++;
+        log_ifln("Class %d (%d masters): %llu requests queued in %.0f s, wait p50 %llu us, p99 %llu us, max %llu us, %llu dropped",
+            p, masters, (unsigned long long)h->count, (now - r->stats_logged_us) / 1e6,
+            (unsigned long long)histogram_percentile(h, 0.5), (unsigned long long)histogram_percentile(h, 0.99),
+            (unsigned long long)histogram_percentile(h, 1.0), (unsigned long long)r->class_dropped[p]);
+    }
+    memset(r->class_wait, 0, sizeof(r->class_wait));
+    memset(r->class_dropped, 0, sizeof(r->class_dropped));
+    r->stats_logged_us = now;
+}
+
+/// @brief Close master connection and remove it from its reactor (reactor thread only)
+static void conn_close(struct conn* c) {
+    struct reactor* r = c->reactor;
+    conn_log_stats(c);
+    for (int i = 0; i < r->count; i++) {
+        if (r->conns[i] == c) {
+            r->conns[i] = r->conns[--r->count];
+            break;
+        }
+    }
+    if (c->io)
+        conn_io_return(c);
+    closesocket(c->sock);
+    conn_free(c);
+    InterlockedDecrement(&conn_count);
+}
+
+/// @brief Target finished transaction (called from target worker thread)
+static void conn_done(struct transaction* tx) {
+    struct conn* c = tx->context;
+    struct reactor* r = c->reactor;
+    EnterCriticalSection(&r->lock);
+    c->next = r->completed;
+    r->completed = c;
+    LeaveCriticalSection(&r->lock);
+    reactor_wake(r);
+}
+
+/// @brief Request answered (or dropped): remove it, a batched next one moves to the front
+static void conn_next(struct conn* c) {
+    struct conn_io* io = c->io;
+    int frame_len = io->in_frame_len;
+    io->in_len -= frame_len;
+    io->in_frame_len = 0;
+    c->state = enCONN_reading;
+    if (!io->in_len) {
+        conn_io_return(c);      // Idle until the master sends again
+        return;
+    }
+    memmove(io->in, io->in + frame_len, io->in_len);
+    io_count_copy(io->in_len);
+    conn_process(c);            // Next request might already be buffered
+}
+
+/// @brief Send pending response to master
+/// @return 0 if OK or pending, <0 connection closed
+static int conn_write(struct conn* c) {
+    struct conn_io* io = c->io;
+    while (io->out_count > 0) {
+        DWORD sent = 0;
+        io_count_syscall();
+        if (WSASend(c->sock, io->out, io->out_count, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+            if (WSAGetLastError() == WSAEWOULDBLOCK)
+                return 0;   // Continue on POLLWRNORM
+            log_efln("%s (%s)", simpleTcpInfoStr(enSIMPLE_TCP_disconnected, "Master"), GetLastErrorString(FALSE));
+            c->reactor->errors.disconnected++;
+            conn_close(c);
+            return -1;
+        }
+        io->out_count = wsabuf_consume(io->out, io->out_count, sent);
+    }
+    uint64_t now = time_us();
+    histogram_record(&c->reactor->turnaround, now - c->received_us);
+    if (c->accepted_us) {
+        histogram_record(&c->reactor->first_response, now - c->accepted_us);
+        c->accepted_us = 0;
+    }
+    conn_next(c);
+    return 0;
+}
+
+/// @brief Build master framing around the response of the completed transaction
+static void conn_respond(struct conn* c) {
+    struct conn_io* io = c->io;
+    struct transaction* tx = &io->tx;
+    if (tx->rsp_len == enSIMPLE_TCP_dropped) {
+        c->flow.dropped++;
+        c->reactor->class_dropped[c->flow.priority]++;
+    } else if (tx->taken_us) {
+        histogram_record(&c->flow.queue_wait, tx->taken_us - tx->enqueued_us);
+        histogram_record(&c->reactor->class_wait[c->flow.priority], tx->taken_us - tx->enqueued_us);
+    }
+    if (tx->rsp_len <= 0) {
+        if (tx->rsp_len == enSIMPLE_TCP_aborted) {
+            conn_close(c);
+            return;
+        }
+        if (tx->rsp_len == enSIMPLE_TCP_dropped) {
+            conn_next(c);       // Master timed out already, a late answer would only confuse it
+            return;
+        }
+        if (tx->req[0] == MODBUS_BROADCAST_UNIT) {
+            conn_next(c);       // Broadcasts are never answered, not even with an exception
+            return;
+        }
+        tx->rsp_len = build_exception(tx->rsp, tx->req, MODBUS_EXC_GATEWAY_NO_RESPONSE);
+    }
+
+    // Header/CRC goes out together with the PDU in place, no copy
+    if (c->rtu) {
+        uint16_t crc = crc16(tx->rsp, tx->rsp_len);
+        memcpy(io->out_head, &crc, sizeof(crc));
+        io->out[0] = (WSABUF){ tx->rsp_len, (char*)tx->rsp };
+        io->out[1] = (WSABUF){ sizeof(crc), (char*)io->out_head };
+    } else {
+        // MBAP with the master's transaction ID, request header is still in front of the input buffer
+        memcpy(io->out_head, io->in, 4);  // Transaction ID, Protocol ID
+        io->out_head[4] = tx->rsp_len >> 8;
+        io->out_head[5] = tx->rsp_len & 0xFF;
+        io->out[0] = (WSABUF){ MBAP_LEN, (char*)io->out_head };
+        io->out[1] = (WSABUF){ tx->rsp_len, (char*)tx->rsp };
+    }
+    io->out_count = 2;
+    capture_frame(c->capture_id, CAPTURE_MASTER | CAPTURE_OUT | (c->rtu ? CAPTURE_RTU : 0), io->out, io->out_count);
+    c->state = enCONN_writing;
+    conn_write(c);
+}
+
+/// @brief Take complete request out of the input buffer and queue it at the target
+static void conn_process(struct conn* c) {
+    struct conn_io* io = c->io;
+    struct transaction* tx = &io->tx;
+    int frame_len;
+
+    if (c->state != enCONN_reading)
+        return;
+
+    if (c->rtu) {
+        frame_len = rtu_frame_length(io->in, io->in_len, rtu_request_length);
+        if (frame_len < 0) {
+            // Like a RTU slave: ignore the broken frame, the master runs into its timeout
+            log_efln("%s (%d bytes dropped)", simpleTcpInfoStr(frame_len, "Master"), io->in_len);
+            error_count(&c->reactor->errors, frame_len);
+            capture_bytes(c->capture_id, CAPTURE_MASTER | CAPTURE_RTU, io->in, io->in_len);
+            capture_dump_error("master RTU frame error");
+            conn_io_return(c);
+            return;
+        }
+        if (frame_len == 0)
+            return;
+        tx->req = io->in;
+        tx->req_len = frame_len -2;     // Strip CRC
+    } else {
+        if (io->in_len < MBAP_LEN)
+            return;
+        int mbap_len = read_uint16_reverse(io->in +4);
+        if (mbap_len < 2 || mbap_len > BUFFER_SIZE - MBAP_LEN) {
+            log_efln("%s (MBAP length %d)", simpleTcpInfoStr(enSIMPLE_TCP_error_tooMuchData, "Master"), mbap_len);
+            c->reactor->errors.too_much_data++;
+            capture_bytes(c->capture_id, CAPTURE_MASTER, io->in, io->in_len);
+            capture_dump_error("master MBAP length");
+            conn_close(c);
+            return;
+        }
+        frame_len = MBAP_LEN + mbap_len;
+        if (io->in_len < frame_len)
+            return;
+        tx->req = io->in + MBAP_LEN;     // Strip MBAP
+        tx->req_len = mbap_len;
+    }
+    io->in_frame_len = frame_len;       // Stays in place until the response is sent
+    capture_bytes(c->capture_id, CAPTURE_MASTER | (c->rtu ? CAPTURE_RTU : 0), io->in, frame_len);
+    c->received_us = time_us();
+
+    c->state = enCONN_waiting;
+    tx->done = conn_done;
+    tx->context = c;
+    tx->taken_us = 0;
+    tx->deadline_us = config()->master_timeout_ms ? c->received_us + config()->master_timeout_ms * 1000ULL : 0;
+
+    // Reads of polled blocks are answered from the image right away
+    if ((tx->rsp_len = poll_lookup(tx->req, tx->req_len, tx->rsp)) > 0) {
+        conn_respond(c);
+        return;
+    }
+    target_submit(route_target(tx->req[0]), tx);
+}
+
+/// @brief Read available data from master
+static void conn_read(struct conn* c) {
+    if (!c->io && conn_io_lend(c)) {
+        conn_close(c);
+        return;
+    }
+    struct conn_io* io = c->io;
+    int len = recv(c->sock, (char*)io->in + io->in_len, BUFFER_SIZE - io->in_len, 0);
+    io_count_syscall();
+    if (len == 0) {
+        log_wfln("Master disconnected (%s)", GetLastErrorString(FALSE));
+        conn_close(c);
+        return;
+    }
+    if (len < 0) {
+        if (WSAGetLastError() == WSAEWOULDBLOCK) {
+            if (!io->in_len)
+                conn_io_return(c);
+            return;
+        }
+        log_efln("%s (%s)", simpleTcpInfoStr(enSIMPLE_TCP_disconnected, "Master"), GetLastErrorString(FALSE));
+        c->reactor->errors.disconnected++;
+        conn_close(c);
+        return;
+    }
+    io->in_len += len;
+    conn_process(c);
+}
+
+static DWORD WINAPI reactor_thread(LPVOID lpParam) {
+    struct reactor* r = lpParam;
+    WSAPOLLFD* fds = NULL;
+    int fds_capacity = 0;
+    int reader = config_reader_register();
+
+    while (!isStop()) {
+        config_quiescent(reader);
+        if (fds_capacity < r->count +1) {
+            fds_capacity = r->count +16;
+            WSAPOLLFD* grown = realloc(fds, fds_capacity * sizeof(WSAPOLLFD));
+            if (!grown) {
+                log_efln("Reactor realloc failed: %s", GetLastErrorString(FALSE));
+                break;
+            }
+            fds = grown;
+        }
+
+        fds[0].fd = r->wake;
+        fds[0].events = POLLRDNORM;
+        int n = r->count;
+        for (int i = 0; i < n; i++) {
+            struct conn* c = r->conns[i];
+            fds[i +1].fd = c->state == enCONN_waiting ? INVALID_SOCKET : c->sock;
+            fds[i +1].events = c->state == enCONN_writing ? POLLWRNORM : POLLRDNORM;
+            fds[i +1].revents = 0;
+        }
+
+        int ready = WSAPoll(fds, n +1, REACTOR_POLL_TIMEOUT);
+        if (ready == SOCKET_ERROR) {
+            log_efln("WSAPoll failed: %s", GetLastErrorString(FALSE));
+            Sleep(10);
+            continue;
+        }
+
+        // Backwards, conn_close() moves the last connection into the freed slot
+        for (int i = n -1; ready > 0 && i >= 0; i--) {
+            struct conn* c = r->conns[i];
+            short revents = fds[i +1].revents;
+            if (!revents || c->state == enCONN_waiting)
+                continue;
+            if (c->state == enCONN_writing)
+                conn_write(c);
+            else
+                conn_read(c);
+        }
+
+        if (fds[0].revents) {
+            char drain[64];
+            recv(r->wake, drain, sizeof(drain), 0);     // Left over datagrams only cause another empty round
+        }
+
+        InterlockedExchange(&r->wake_pending, 0);
+        EnterCriticalSection(&r->lock);
+        struct conn* added = r->added;
+        struct conn* completed = r->completed;
+        r->added = r->completed = NULL;
+        LeaveCriticalSection(&r->lock);
+
+        while (added) {
+            struct conn* c = added;
+            added = c->next;
+            if (conn_setup(c))
+                continue;
+            if (r->count == r->capacity) {
+                int capacity = r->capacity ? r->capacity *2 : 64;
+                struct conn** grown = realloc(r->conns, capacity * sizeof(struct conn*));
+                if (!grown) {
+                    log_efln("Reactor realloc failed: %s", GetLastErrorString(FALSE));
+                    closesocket(c->sock);
+                    conn_free(c);
+                    InterlockedDecrement(&conn_count);
+                    continue;
+                }
+                r->conns = grown;
+                r->capacity = capacity;
+            }
+            r->conns[r->count++] = c;
+        }
+        while (completed) {
+            struct conn* c = completed;
+            completed = c->next;
+            conn_respond(c);
+        }
+
+        if (time_us() - r->stats_logged_us >= STATS_INTERVAL_US)
+            reactor_log_stats(r);
+    }
+
+    config_reader_unregister(reader);
+    free(fds);
+    return 0;
+}
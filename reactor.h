@@ -0,0 +1,113 @@
+/*
+ * File   : reactor.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the event driven master connection handling.
+ *               A fixed number of reactor threads poll all master sockets
+ *               (non-blocking) and drive each connection as state machine.
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdint.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "comm.h"
+#include "target.h"
+#include "stats.h"
+
+
+enum enCONN_STATE {
+    enCONN_reading = 0,     // Waiting for (the rest of) a request from master
+    enCONN_waiting,         // Request queued at target, waiting for completion
+    enCONN_writing          // Response (partially) sent to master
+};
+
+/// @brief Buffers of a master connection, lent from the reactor's pool while a request
+/// @brief is received, in flight or answered, so idle connections hold none
+struct conn_io {
+    uint8_t in[BUFFER_SIZE];                // Received data, the request in flight is used in place
+    int in_len;
+    int in_frame_len;                       // Length of the request in flight at the start of in
+    uint8_t out_head[MBAP_LEN];             // MBAP header or CRC for the response PDU in tx.rsp
+    WSABUF out[2];                          // Response for master (scatter/gather), not yet sent part
+    int out_count;
+    struct transaction tx;
+
+    struct conn_io* next;                   // Link in the reactor's pool
+};
+
+/// @brief State of one master connection, owned by its reactor thread
+struct conn {
+    SOCKET sock;
+    boolean rtu;                            // TRUE: master speaks RTU over TCP, FALSE: Modbus TCP
+    volatile LONG state;                    // see enCONN_STATE
+    struct conn_io* io;                     // Lent buffers, NULL while idle
+
+    uint64_t received_us;                   // Request in flight complete
+    uint64_t accepted_us;                   // Connection accepted, 0 once the first response is sent
+    struct flow flow;                       // Priority class, fair share and queueing delay of this master
+    char peer[32];                          // Address:port of master, for the statistics
+    uint32_t capture_id;                    // Connection id in traffic captures
+
+    struct reactor* reactor;
+    struct conn* next;                      // Link in added/completed list, or in the free list of the slab
+};
+
+/// @brief One reactor thread with its connections
+struct reactor {
+    CRITICAL_SECTION lock;
+    struct conn* added;                     // New connections (locked)
+    struct conn* completed;                 // Connections with completed transaction (locked)
+
+    struct conn** conns;                    // Owned by reactor thread
+    int count;
+    int capacity;
+    struct conn_io* io_pool;                // Buffers not lent, at most REACTOR_IO_SPARE kept
+    int io_pool_count;
+
+    SOCKET wake;                            // UDP loopback socket to interrupt WSAPoll
+    volatile LONG wake_pending;             // Wake datagram sent, not yet seen by the reactor
+    struct sockaddr_in wake_addr;
+
+    // Metrics, written by the reactor thread only
+    struct histogram turnaround;            // Request received until response sent
+    struct histogram first_response;        // Connection accepted until first response sent
+    struct error_counters errors;           // Master side errors
+    struct histogram class_wait[CONFIG_PRIORITY_CLASSES];   // Queue wait per priority class since stats_logged_us
+    uint64_t class_dropped[CONFIG_PRIORITY_CLASSES];        // Dropped per priority class since stats_logged_us
+    uint64_t stats_logged_us;
+
+    HANDLE thread;
+};
+
+
+/// @brief Start reactor threads
+/// @param threads Number of reactor threads (<=0: one per processor)
+/// @return 0 if OK, <0 error
+int reactor_start(int threads);
+
+/// @brief Hand accepted master socket over to a reactor thread, which sets it up
+/// @brief Closed right away if --max-connections masters are connected already
+/// @param master Accepted Socket (Master)
+/// @param rtu TRUE if master speaks RTU over TCP, FALSE for Modbus TCP
+void reactor_add(SOCKET master, boolean rtu);
+
+/// @brief Connected masters
+/// @return Count
+int reactor_connections();
+
+/// @brief Masters closed right away because of --max-connections
+/// @return Count since start
+uint64_t reactor_rejected();
+
+/// @brief Sum up the metrics of all reactor threads
+/// @param turnaround Histogram to add the master turnaround times to (zeroed by caller)
+/// @param first_response Histogram to add the accept to first response times to (zeroed by caller)
+/// @param errors Counters to add the master side errors to (zeroed by caller)
+void reactor_metrics(struct histogram* turnaround, struct histogram* first_response, struct error_counters* errors);
+
+#endif
@@ -0,0 +1,391 @@
+/*
+ * File   : replay.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the replay driver. The pcap file is
+ *               split into request streams (client address/port to server
+ *               port 502 or the capture RTU port), each stream is replayed
+ *               by one thread over its own connection: wait for the
+ *               captured send time (scaled by speed), send, wait for the
+ *               response. Frames are re-framed for the given protocol.
+ */
+
+#include "replay.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#include "cli.h"
+#include "comm.h"
+#include "crc.h"
+#include "endian.h"
+#include "frame.h"
+#include "stats.h"
+#include "capture.h"
+
+#define REPLAY_MAX_STREAMS  1024
+#define PCAP_MAGIC_US       0xA1B2C3D4
+#define PCAP_MAGIC_NS       0xA1B23C4D
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_IPV4       228
+
+
+/// @brief One captured request, unit id + PDU
+struct replay_request {
+    uint64_t time_us;               // Relative to the first request of the capture
+    int len;
+    uint8_t pdu[BUFFER_SIZE];
+};
+
+/// @brief Requests of one captured master connection
+struct replay_stream {
+    uint32_t src_address;           // Stream key
+    uint16_t src_port;
+    uint32_t dst_address;
+    uint16_t dst_port;
+
+    struct replay_request* requests;
+    int count;
+    int capacity;
+
+    struct replay* replay;
+    HANDLE thread;
+    struct histogram latency;       // Written by the stream thread only
+    uint64_t answered;
+    uint64_t exceptions;
+    uint64_t errors;
+    uint64_t behind_max_us;         // Largest delay of a send against its captured time
+};
+
+struct replay {
+    boolean rtu;                    // TRUE: RTU over TCP, FALSE: Modbus TCP
+    struct addrinfo* addr;
+    double speed;                   // Time scale, 0: as fast as possible
+    uint64_t start_us;
+
+    struct replay_stream* streams;
+    int stream_count;
+};
+
+
+/// @brief Stream of key, new one if not yet seen
+static struct replay_stream* replay_stream_get(struct replay* r, uint32_t src_address, uint16_t src_port,
+                                               uint32_t dst_address, uint16_t dst_port) {
+    for (int i = 0; i < r->stream_count; i++) {
+        struct replay_stream* s = &r->streams[i];
+        if (s->src_address == src_address && s->src_port == src_port && s->dst_address == dst_address && s->dst_port == dst_port)
+            return s;
+    }
+    if (r->stream_count >= REPLAY_MAX_STREAMS)
+        return NULL;
+    struct replay_stream* s = &r->streams[r->stream_count++];
+    s->src_address = src_address;
+    s->src_port = src_port;
+    s->dst_address = dst_address;
+    s->dst_port = dst_port;
+    s->replay = r;
+    return s;
+}
+
+/// @brief Append request (unit id + PDU) to stream
+static void replay_stream_add(struct replay_stream* s, uint64_t time_us, const uint8_t* pdu, int len) {
+    if (len < 2 || len > BUFFER_SIZE)
+        return;
+    if (s->count == s->capacity) {
+        int capacity = s->capacity ? s->capacity *2 : 256;
+        struct replay_request* grown = realloc(s->requests, capacity * sizeof(struct replay_request));
+        if (!grown)
+            return;
+        s->requests = grown;
+        s->capacity = capacity;
+    }
+    struct replay_request* req = &s->requests[s->count++];
+    req->time_us = time_us;
+    req->len = len;
+    memcpy(req->pdu, pdu, len);
+}
+
+/// @brief Split payload of one packet into requests: MBAP frames or RTU frames (CRC checked)
+static void replay_payload(struct replay_stream* s, uint64_t time_us, boolean rtu, const uint8_t* data, int len) {
+    while (len > 0) {
+        int frame_len;
+        if (rtu) {
+            frame_len = rtu_frame_length(data, len, rtu_request_length);
+            if (frame_len <= 0)
+                return;             // Broken or partial frame
+            replay_stream_add(s, time_us, data, frame_len -2);
+        } else {
+            if (len < MBAP_LEN +2)
+                return;
+            frame_len = MBAP_LEN + read_uint16_reverse(data +4);
+            if (frame_len > len)
+                return;             // Continues in the next segment, not reassembled
+            replay_stream_add(s, time_us, data + MBAP_LEN, frame_len - MBAP_LEN);
+        }
+        data += frame_len;
+        len -= frame_len;
+    }
+}
+
+/// @brief Read requests of all client streams out of a pcap file
+/// @return 0 if OK, -1 error
+static int replay_load(struct replay* r, const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        log_efln("Replay: %s not readable", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* file = size > 24 ? malloc(size) : NULL;
+    if (!file || fread(file, 1, size, f) != (size_t)size) {
+        log_efln("Replay: %s not readable", path);
+        free(file);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    uint32_t magic, linktype;
+    memcpy(&magic, file, 4);
+    memcpy(&linktype, file +20, 4);
+    if ((magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS)
+            || (linktype != LINKTYPE_ETHERNET && linktype != LINKTYPE_RAW && linktype != LINKTYPE_IPV4)) {
+        log_efln("Replay: %s is no pcap file of Ethernet or IPv4 packets", path);
+        free(file);
+        return -1;
+    }
+
+    // Requests go to the server port, from gateway captures only the master side
+    boolean gateway_capture = FALSE;
+    for (int pass = 0; pass < 2; pass++) {
+        uint64_t first_us = 0;
+        boolean first = TRUE;
+        for (long pos = 24; pos + 16 <= size; ) {
+            uint32_t record[4];
+            memcpy(record, file + pos, sizeof(record));
+            const uint8_t* ip = file + pos +16;
+            int len = record[2];
+            pos += 16 + record[2];
+            if (pos > size)
+                break;
+
+            if (linktype == LINKTYPE_ETHERNET) {
+                if (len < 14 + 20 || read_uint16_reverse(ip +12) != 0x0800)
+                    continue;
+                ip += 14;
+                len -= 14;
+            }
+            if (len < 20 || (ip[0] >> 4) != 4)
+                continue;
+            int ip_head = (ip[0] & 0x0F) * 4;
+            int ip_len = read_uint16_reverse(ip +2);
+            if (ip_len < len)
+                len = ip_len;
+            int l4_head = ip[9] == 17 ? 8 : ip[9] == 6 && len >= ip_head + 20 ? (ip[ip_head +12] >> 4) * 4 : 0;
+            if (!l4_head || len < ip_head + l4_head)
+                continue;
+            uint32_t src_address = read_uint32_reverse(ip +12);
+            uint32_t dst_address = read_uint32_reverse(ip +16);
+            uint16_t src_port = read_uint16_reverse(ip + ip_head);
+            uint16_t dst_port = read_uint16_reverse(ip + ip_head +2);
+            if ((dst_port != CAPTURE_MBAP_PORT && dst_port != CAPTURE_RTU_PORT) || len == ip_head + l4_head)
+                continue;
+
+            if (pass == 0) {
+                gateway_capture |= dst_address == CAPTURE_GATEWAY_ADDRESS;
+                continue;
+            }
+            if (gateway_capture && dst_address != CAPTURE_GATEWAY_ADDRESS)
+                continue;
+            uint64_t time_us = magic == PCAP_MAGIC_NS
+                ? (uint64_t)record[0] * 1000000 + record[1] / 1000
+                : (uint64_t)record[0] * 1000000 + record[1];
+            if (first)
+                first_us = time_us;
+            first = FALSE;
+            struct replay_stream* s = replay_stream_get(r, src_address, src_port, dst_address, dst_port);
+            if (s)
+                replay_payload(s, time_us - first_us, dst_port == CAPTURE_RTU_PORT,
+                    ip + ip_head + l4_head, len - ip_head - l4_head);
+        }
+    }
+    free(file);
+    return 0;
+}
+
+/// @brief Connect to the gateway under test
+static SOCKET replay_connect(struct replay* r) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    DWORD timeout = TCP_TIMEOUT;
+    BOOL nodelay = TRUE;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+    if (connect(sock, r->addr->ai_addr, (int)r->addr->ai_addrlen) != 0) {
+        log_efln("Replay: connect failed: %s", GetLastErrorString(FALSE));
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+static DWORD WINAPI replay_connection(LPVOID lpParam) {
+    struct replay_stream* s = lpParam;
+    struct replay* r = s->replay;
+    uint8_t req[MBAP_LEN + BUFFER_SIZE +2];
+    uint8_t rsp[MBAP_LEN + BUFFER_SIZE];
+    struct rtu_stream stream = {0};
+    uint16_t transactionId = 0;
+    SOCKET sock = INVALID_SOCKET;
+
+    for (int i = 0; i < s->count; i++) {
+        struct replay_request* q = &s->requests[i];
+        if (r->speed > 0) {
+            // Captured pace: send at the scaled capture time, or right away if behind
+            uint64_t due_us = r->start_us + (uint64_t)(q->time_us / r->speed);
+            uint64_t now = time_us();
+            if (due_us > now + 1000)
+                Sleep((DWORD)((due_us - now) / 1000));
+            now = time_us();
+            if (now > due_us && now - due_us > s->behind_max_us)
+                s->behind_max_us = now - due_us;
+        }
+        if (sock == INVALID_SOCKET) {
+            stream.len = 0;
+            if ((sock = replay_connect(r)) == INVALID_SOCKET) {
+                s->errors += s->count - i;
+                break;
+            }
+        }
+
+        int req_len;
+        if (r->rtu) {
+            memcpy(req, q->pdu, q->len);
+            uint16_t crc = crc16(req, q->len);
+            memcpy(req + q->len, &crc, sizeof(crc));
+            req_len = q->len +2;
+        } else {
+            transactionId++;
+            req[0] = transactionId >> 8;
+            req[1] = transactionId & 0xFF;
+            req[2] = 0;
+            req[3] = 0;
+            req[4] = q->len >> 8;
+            req[5] = q->len & 0xFF;
+            memcpy(req + MBAP_LEN, q->pdu, q->len);
+            req_len = MBAP_LEN + q->len;
+        }
+
+        uint64_t start_us = time_us();
+        if (q->pdu[0] == MODBUS_BROADCAST_UNIT) {
+            send_all(sock, req, req_len);   // Broadcast: the gateway answers in neither protocol
+            continue;
+        }
+        int rsp_len = send_all(sock, req, req_len) == req_len
+            ? (r->rtu ? recv_rtu(sock, &stream, rsp) : recv_mbap(sock, rsp, sizeof(rsp)))
+            : enSIMPLE_TCP_disconnected;
+        const uint8_t* pdu = r->rtu ? rsp : rsp + MBAP_LEN;
+        if (rsp_len <= 0 || (!r->rtu && read_uint16_reverse(rsp) != transactionId)) {
+            s->errors++;
+            closesocket(sock);          // Reconnect, a late response would desync the rest
+            sock = INVALID_SOCKET;
+            continue;
+        }
+        histogram_record(&s->latency, time_us() - start_us);
+        s->answered++;
+        if (pdu[1] & 0x80)
+            s->exceptions++;
+    }
+    if (sock != INVALID_SOCKET)
+        closesocket(sock);
+    return 0;
+}
+
+int replay_main(int argc, char* argv[]) {
+    if (argc < 4 || (strcmp(argv[0], "tcp") != 0 && strcmp(argv[0], "rtu") != 0)) {
+        log_ln("Usage: replay tcp|rtu <capture.pcap> <host> <port> [speed|max]");
+        return 1;
+    }
+    struct replay r = {0};
+    r.rtu = strcmp(argv[0], "rtu") == 0;
+    r.speed = argc > 4 ? (strcmp(argv[4], "max") == 0 ? 0 : atof(argv[4])) : 1;
+    if (argc > 4 && strcmp(argv[4], "max") != 0 && r.speed <= 0) {
+        log_eln("Replay: invalid speed");
+        return 1;
+    }
+    r.streams = calloc(REPLAY_MAX_STREAMS, sizeof(struct replay_stream));
+    if (!r.streams || replay_load(&r, argv[1])) {
+        free(r.streams);
+        return 1;
+    }
+
+    uint64_t requests = 0, captured_us = 0;
+    for (int i = 0; i < r.stream_count; i++) {
+        requests += r.streams[i].count;
+        if (r.streams[i].count && r.streams[i].requests[r.streams[i].count -1].time_us > captured_us)
+            captured_us = r.streams[i].requests[r.streams[i].count -1].time_us;
+    }
+    if (!requests) {
+        log_efln("Replay: no requests in %s", argv[1]);
+        free(r.streams);
+        return 1;
+    }
+
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2,2), &wsa);
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[2], argv[3], &hints, &r.addr) != 0 || !r.addr) {
+        log_efln("Replay: address resolution of %s:%s failed: %s", argv[2], argv[3], GetLastErrorString(FALSE));
+        WSACleanup();
+        return 1;
+    }
+
+    log_fln("Replay %llu requests of %d masters (%.3f s captured) as %s -> %s:%s, %s",
+        (unsigned long long)requests, r.stream_count, captured_us / 1e6, r.rtu ? "RTU over TCP" : "Modbus TCP",
+        argv[2], argv[3], r.speed > 0 ? "captured pace" : "as fast as possible");
+    r.start_us = time_us();
+    for (int i = 0; i < r.stream_count; i++)
+        r.streams[i].thread = CreateThread(NULL, 0, replay_connection, &r.streams[i], 0, NULL);
+
+    struct histogram latency = {0};
+    uint64_t answered = 0, exceptions = 0, errors = 0, behind_max_us = 0;
+    for (int i = 0; i < r.stream_count; i++) {
+        struct replay_stream* s = &r.streams[i];
+        if (s->thread) {
+            WaitForSingleObject(s->thread, INFINITE);
+            CloseHandle(s->thread);
+        } else {
+            s->errors += s->count;
+        }
+        histogram_add(&latency, &s->latency);
+        answered += s->answered;
+        exceptions += s->exceptions;
+        errors += s->errors;
+        if (s->behind_max_us > behind_max_us)
+            behind_max_us = s->behind_max_us;
+        free(s->requests);
+    }
+    double elapsed = (time_us() - r.start_us) / 1e6;
+
+    log_ln("  Requests   Answered Exceptions     Errors  Elapsed s      Req/s    p50 ms    p99 ms   p999 ms  Behind ms");
+    log_fln("%10llu %10llu %10llu %10llu %10.3f %10.0f %9.3f %9.3f %9.3f %10.1f",
+        (unsigned long long)requests, (unsigned long long)answered, (unsigned long long)exceptions,
+        (unsigned long long)errors, elapsed, answered / elapsed,
+        histogram_percentile(&latency, 0.50) / 1e3, histogram_percentile(&latency, 0.99) / 1e3,
+        histogram_percentile(&latency, 0.999) / 1e3, behind_max_us / 1e3);
+
+    free(r.streams);
+    freeaddrinfo(r.addr);
+    WSACleanup();
+    return errors ? 2 : 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * File   : replay.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the replay driver: feeds the master requests
+ *               of a capture (see capture.h, or any pcap with Modbus on
+ *               TCP/UDP port 502) back through a gateway, at the captured
+ *               pace or as fast as possible
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+/// @brief Replay the requests of every captured master over its own connection, print latency
+/// @brief Arguments: tcp|rtu <capture.pcap> <host> <port> [speed|max]
+/// @param argc Number of arguments behind "replay"
+/// @param argv Arguments behind "replay"
+/// @return Exit code
+int replay_main(int argc, char* argv[]);
+
+#endif
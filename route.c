@@ -0,0 +1,113 @@
+/*
+ * File   : route.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the unit id routing table. The table is
+ *               read without lock, a reload overwrites its entries one by
+ *               one. Targets are created on first use and kept, a target
+ *               no longer routed to just stops reconnecting.
+ */
+
+#include "route.h"
+
+#include <string.h>
+
+#include "cli.h"
+#include "config.h"
+#include "target.h"
+
+
+static struct target* volatile routes[256];
+static struct target* targets[ROUTE_MAX_TARGETS];
+static volatile LONG target_count = 0;
+
+
+/// @brief Target for endpoint, created on first use
+/// @return Target or NULL on error
+static struct target* route_endpoint(const char* host, int port, boolean rtu) {
+    for (int i = 0; i < target_count; i++) {
+        if (targets[i]->port == port && strcmp(targets[i]->host, host) == 0)
+            return targets[i];
+    }
+    if (target_count >= ROUTE_MAX_TARGETS) {
+        log_efln("Too many targets (max %d)", ROUTE_MAX_TARGETS);
+        return NULL;
+    }
+    struct target* t = target_create(host, port, rtu);
+    if (t) {
+        targets[target_count] = t;
+        InterlockedIncrement(&target_count);    // Published for the statistics after it is stored
+    }
+    return t;
+}
+
+/// @brief Fill table for the current settings, targets of new endpoints are created
+/// @return 0 if OK, -1 error
+static int route_build(struct target* table[256], boolean rtu) {
+    const struct config* cfg = config();
+    memset(table, 0, 256 * sizeof(struct target*));
+
+    // Later routes override earlier ones for overlapping unit ids
+    for (int i = 0; i < cfg->route_count; i++) {
+        const struct route_rule* rule = &cfg->routes[i];
+        struct target* t = route_endpoint(rule->host, rule->port, rtu);
+        if (!t)
+            return -1;
+        for (int unit = rule->unit_first; unit <= rule->unit_last; unit++)
+            table[unit] = t;
+        log_fln("Units %d-%d -> %s:%d", rule->unit_first, rule->unit_last, rule->host, rule->port);
+    }
+
+    for (int unit = 0; unit < 256; unit++) {
+        if (table[unit])
+            continue;
+        struct target* t = route_endpoint(cfg->target_host, cfg->target_port, rtu);
+        if (!t)
+            return -1;
+        for (; unit < 256; unit++) {
+            if (!table[unit])
+                table[unit] = t;
+        }
+        if (cfg->route_count)
+            log_fln("Other units -> %s:%d", cfg->target_host, cfg->target_port);
+    }
+    return 0;
+}
+
+int route_start(boolean rtu) {
+    struct target* table[256];
+    if (route_build(table, rtu))
+        return -1;
+    for (int unit = 0; unit < 256; unit++)
+        routes[unit] = table[unit];
+    return 0;
+}
+
+void route_reload(boolean rtu) {
+    struct target* table[256];
+    if (route_build(table, rtu)) {
+        log_eln("Routes not reloaded, the current ones stay");
+        return;
+    }
+
+    // Requests already queued finish on their target, new ones go by the new table
+    for (int unit = 0; unit < 256; unit++)
+        routes[unit] = table[unit];
+    for (int i = 0; i < target_count; i++) {
+        struct target* t = targets[i];
+        boolean routed = FALSE;
+        for (int unit = 0; unit < 256 && !routed; unit++)
+            routed = table[unit] == t;
+        if (t->routed && !routed)
+            log_fln("Target %s:%d no longer routed, it is not reconnected", t->host, t->port);
+        t->routed = routed;
+        target_configure(t);
+    }
+}
+
+struct target* route_target(uint8_t unit) { return routes[unit]; }
+
+int route_target_count() { return target_count; }
+
+struct target* route_target_at(int index) { return targets[index]; }
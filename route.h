@@ -0,0 +1,46 @@
+/*
+ * File   : route.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the unit id routing table. Each unit id is
+ *               mapped to one upstream target, targets with the same
+ *               endpoint are shared, unrouted unit ids go to the default.
+ */
+
+#ifndef __ROUTE_H__
+#define __ROUTE_H__
+
+#include <stdint.h>
+#include <windows.h>
+
+#define ROUTE_MAX_TARGETS   64
+
+struct target;
+
+
+/// @brief Create the targets of all --route options and the default target (--target)
+/// @param rtu TRUE if targets speak RTU over TCP, FALSE for Modbus TCP
+/// @return 0 if OK, -1 error
+int route_start(boolean rtu);
+
+/// @brief Route by the reloaded settings: targets of new endpoints are created, the others keep
+/// @brief their connection and get the new window and cache settings
+/// @param rtu TRUE if targets speak RTU over TCP, FALSE for Modbus TCP
+void route_reload(boolean rtu);
+
+/// @brief Target a request is forwarded to
+/// @param unit Unit id of the request
+/// @return Target
+struct target* route_target(uint8_t unit);
+
+/// @brief Number of distinct targets
+/// @return Count
+int route_target_count();
+
+/// @brief Distinct target by index, for statistics
+/// @param index 0 .. route_target_count()-1
+/// @return Target
+struct target* route_target_at(int index);
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * File   : rto.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the adaptive response timeout
+ */
+
+#include "rto.h"
+
+#include "comm.h"
+
+
+int rto_size(const uint8_t* req, int req_len) {
+    int rsp_len = req_len >= 6 ? expected_pdu_length(req[1], req[4]<<8 | req[5]) : -1;
+    return req_len + (rsp_len >= 0 ? rsp_len +1 : req_len);
+}
+
+void rto_sample(struct rto_estimator* e, uint64_t rtt_us, int size) {
+    double x = (double)rtt_us / (RTO_SIZE_BASE + size);
+    if (!e->samples) {
+        e->srtt = x;
+        e->rttvar = x / 2;
+    } else {
+        double delta = e->srtt > x ? e->srtt - x : x - e->srtt;
+        e->rttvar += (delta - e->rttvar) / 4;
+        e->srtt += (x - e->srtt) / 8;
+    }
+    e->samples++;
+    e->backoff = 0;
+}
+
+void rto_backoff(struct rto_estimator* e) {
+    if (e->backoff < RTO_MAX_BACKOFF)
+        e->backoff++;
+}
+
+uint64_t rto_srtt_us(const struct rto_estimator* e, int size) {
+    return (uint64_t)(e->srtt * (RTO_SIZE_BASE + size));
+}
+
+uint64_t rto_timeout_us(const struct rto_estimator* e, int size, uint64_t initial_us) {
+    uint64_t us = e->samples
+        ? (uint64_t)((e->srtt + 4 * e->rttvar) * (RTO_SIZE_BASE + size))
+        : initial_us;
+    if (us < RTO_MIN_US)
+        us = RTO_MIN_US;
+    us <<= e->backoff;
+    return us < RTO_MAX_US ? us : RTO_MAX_US;
+}
@@ -0,0 +1,62 @@
+/*
+ * File   : rto.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Definitions for the adaptive response timeout. Like TCP's
+ *               RTO (RFC 6298) a smoothed RTT plus four times its variance,
+ *               but normalized to the size of the transaction, so a large
+ *               read on a slow bus gets proportionally more time.
+ */
+
+#ifndef __RTO_H__
+#define __RTO_H__
+
+#include <stdint.h>
+
+#define RTO_SIZE_BASE       16      // Bytes that account for the fixed delay of every transaction
+#define RTO_MIN_US          (100 * 1000ULL)
+#define RTO_MAX_US          (10 * 1000 * 1000ULL)
+#define RTO_MAX_BACKOFF     6       // Timeout doubles with each timeout in a row, up to 64x
+#define RTO_REFERENCE_SIZE  12      // Read of one register (request + response), for statistics
+
+
+/// @brief Round trip estimate of a target or unit, written by the target worker only
+struct rto_estimator {
+    uint64_t samples;
+    double srtt;                    // Smoothed RTT in us per size byte
+    double rttvar;                  // Mean deviation in us per size byte
+    int backoff;                    // Timeouts since the last response
+};
+
+
+/// @brief Size of a transaction for the estimate: request plus expected response
+/// @param req Unit id + PDU of the request
+/// @param req_len Length of req
+/// @return Size in bytes
+int rto_size(const uint8_t* req, int req_len);
+
+/// @brief Add a measured round trip (responses only, never retransmissions or timeouts)
+/// @param e Estimator
+/// @param rtt_us Round trip in us
+/// @param size Size of the transaction (see rto_size)
+void rto_sample(struct rto_estimator* e, uint64_t rtt_us, int size);
+
+/// @brief Count a timeout, the next timeouts are doubled until a response arrives
+/// @param e Estimator
+void rto_backoff(struct rto_estimator* e);
+
+/// @brief Smoothed round trip for a transaction
+/// @param e Estimator
+/// @param size Size of the transaction (see rto_size)
+/// @return Round trip in us, 0 without sample
+uint64_t rto_srtt_us(const struct rto_estimator* e, int size);
+
+/// @brief Response timeout for a transaction
+/// @param e Estimator
+/// @param size Size of the transaction (see rto_size)
+/// @param initial_us Timeout as long as there is no sample
+/// @return Timeout in us
+uint64_t rto_timeout_us(const struct rto_estimator* e, int size, uint64_t initial_us);
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * File   : sim.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the Modbus slave simulator. Answers all
+ *               unit ids from one register image, one thread per connection.
+ *               Every response waits for the configured delay and, with a
+ *               baud rate given, for the time request and response need on
+ *               a serial line, one transaction at a time on the shared bus.
+ *               With a reorder time a Modbus TCP read response waits until
+ *               the response to the next request has overtaken it.
+ */
+
+#include "sim.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "cli.h"
+#include "comm.h"
+#include "crc.h"
+#include "endian.h"
+#include "frame.h"
+
+#pragma comment(lib, "winmm.lib")
+
+#define SIM_BITS_PER_BYTE   11      // Start, 8 data, parity/stop, stop
+
+
+struct sim {
+    boolean rtu;                    // TRUE: RTU over TCP, FALSE: Modbus TCP
+    int delay_ms;                   // Response delay of the slave
+    int baud;                       // Serial line speed to emulate, 0 none
+    int reorder_ms;                 // Modbus TCP: hold read responses up to this long for the next one to overtake, 0 in order
+    CRITICAL_SECTION bus;           // One transaction at a time on the emulated line
+
+    // Register image, shared by all units and connections (races are fine for a simulator)
+    uint16_t registers[65536];      // Holding registers (0x03), input registers read address ^ 0x8000
+    uint8_t coils[65536];           // Coils (0x01), discrete inputs read the inverted coil
+};
+
+static struct sim sim;
+
+
+/// @brief Exception response
+static int sim_exception(const uint8_t* req, uint8_t* rsp, uint8_t code) {
+    rsp[0] = req[0];
+    rsp[1] = req[1] | 0x80;
+    rsp[2] = code;
+    return 3;
+}
+
+/// @brief Answer request from the register image
+/// @param req Unit id + PDU
+/// @param req_len Length of req
+/// @param rsp Unit id + PDU of the response (BUFFER_SIZE)
+/// @return Length of rsp
+static int sim_pdu(const uint8_t* req, int req_len, uint8_t* rsp) {
+    uint8_t fc = req[1];
+    if (req_len < 6)
+        return sim_exception(req, rsp, 0x03);
+    uint16_t address = read_uint16_reverse(req +2);
+    uint16_t value = read_uint16_reverse(req +4);
+
+    rsp[0] = req[0];
+    rsp[1] = fc;
+    switch (fc) {
+        case 0x01:
+        case 0x02:
+            if (value < 1 || value > 2000)
+                return sim_exception(req, rsp, 0x03);
+            if (address + value > 65536)
+                return sim_exception(req, rsp, 0x02);
+            rsp[2] = (value + 7) / 8;
+            memset(rsp +3, 0, rsp[2]);
+            for (int i = 0; i < value; i++)
+                if (sim.coils[address + i] ^ (fc == 0x02))
+                    rsp[3 + i/8] |= 1 << (i % 8);
+            return 3 + rsp[2];
+        case 0x03:
+        case 0x04:
+            if (value < 1 || value > 125)
+                return sim_exception(req, rsp, 0x03);
+            if (address + value > 65536)
+                return sim_exception(req, rsp, 0x02);
+            rsp[2] = value * 2;
+            for (int i = 0; i < value; i++) {
+                uint16_t v = fc == 0x03 ? sim.registers[address + i] : (uint16_t)((address + i) ^ 0x8000);
+                rsp[3 + 2*i] = v >> 8;
+                rsp[4 + 2*i] = v & 0xFF;
+            }
+            return 3 + rsp[2];
+        case 0x05:
+            if (value != 0x0000 && value != 0xFF00)
+                return sim_exception(req, rsp, 0x03);
+            sim.coils[address] = value == 0xFF00;
+            memcpy(rsp, req, 6);
+            return 6;
+        case 0x06:
+            sim.registers[address] = value;
+            memcpy(rsp, req, 6);
+            return 6;
+        case 0x0F:
+            if (req_len < 7 || value < 1 || value > 1968 || req[6] != (value + 7) / 8 || req_len < 7 + req[6])
+                return sim_exception(req, rsp, 0x03);
+            if (address + value > 65536)
+                return sim_exception(req, rsp, 0x02);
+            for (int i = 0; i < value; i++)
+                sim.coils[address + i] = req[7 + i/8] >> (i % 8) & 1;
+            memcpy(rsp, req, 6);
+            return 6;
+        case 0x10:
+            if (req_len < 7 || value < 1 || value > 123 || req[6] != value * 2 || req_len < 7 + req[6])
+                return sim_exception(req, rsp, 0x03);
+            if (address + value > 65536)
+                return sim_exception(req, rsp, 0x02);
+            for (int i = 0; i < value; i++)
+                sim.registers[address + i] = read_uint16_reverse(req + 7 + 2*i);
+            memcpy(rsp, req, 6);
+            return 6;
+        default:
+            return sim_exception(req, rsp, 0x01);
+    }
+}
+
+/// @brief Delay of the slave and, when emulating a serial line, the time on the wire
+static void sim_respond_wait(int req_len, int rsp_len) {
+    uint64_t us = sim.delay_ms * 1000ULL;
+    if (sim.baud)
+        us += (uint64_t)(req_len + rsp_len + 4) * SIM_BITS_PER_BYTE * 1000000 / sim.baud;    // +CRCs
+    if (us)
+        wait_us(us);
+}
+
+/// @brief Serve one master connection until it disconnects
+static DWORD WINAPI sim_connection(LPVOID lpParam) {
+    SOCKET sock = (SOCKET)(uintptr_t)lpParam;
+    uint8_t in[2 * BUFFER_SIZE];
+    uint8_t out[MBAP_LEN + BUFFER_SIZE];
+    uint8_t held[MBAP_LEN + BUFFER_SIZE];   // Read response waiting to be overtaken (reorder_ms)
+    int in_len = 0, held_len = 0;
+    uint64_t held_until_us = 0;
+
+    BOOL nodelay = TRUE;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+    for (;;) {
+        if (held_len) {
+            // Nothing overtook it in time: answer in order after all
+            uint64_t now = time_us();
+            WSAPOLLFD pfd = { sock, POLLRDNORM, 0 };
+            if (now >= held_until_us || WSAPoll(&pfd, 1, (int)((held_until_us - now + 999) / 1000)) == 0) {
+                if (send_all(sock, held, held_len) != held_len)
+                    break;
+                held_len = 0;
+                continue;
+            }
+        }
+        int len = recv(sock, (char*)in + in_len, sizeof(in) - in_len, 0);
+        if (len <= 0)
+            break;
+        in_len += len;
+
+        for (;;) {
+            const uint8_t* req;
+            int req_len, frame_len;
+            if (sim.rtu) {
+                frame_len = rtu_frame_length(in, in_len, rtu_request_length);
+                if (frame_len < 0) {
+                    in_len = 0;         // Broken frame: like a slave, stay silent
+                    break;
+                }
+                req = in;
+                req_len = frame_len -2;
+            } else {
+                if (in_len < MBAP_LEN)
+                    break;
+                req_len = read_uint16_reverse(in +4);
+                if (req_len < 2 || req_len > BUFFER_SIZE - MBAP_LEN) {
+                    in_len = 0;
+                    break;
+                }
+                frame_len = in_len >= MBAP_LEN + req_len ? MBAP_LEN + req_len : 0;
+                req = in + MBAP_LEN;
+            }
+            if (frame_len == 0)
+                break;
+
+            uint8_t* rsp = sim.rtu ? out : out + MBAP_LEN;
+            int rsp_len = sim_pdu(req, req_len, rsp);
+            int out_len;
+            if (sim.rtu) {
+                uint16_t crc = crc16(rsp, rsp_len);
+                memcpy(rsp + rsp_len, &crc, sizeof(crc));
+                out_len = rsp_len +2;
+            } else {
+                memcpy(out, in, 4);     // Transaction and protocol ID
+                out[4] = rsp_len >> 8;
+                out[5] = rsp_len & 0xFF;
+                out_len = MBAP_LEN + rsp_len;
+            }
+
+            if (sim.baud)
+                EnterCriticalSection(&sim.bus);
+            sim_respond_wait(req_len, rsp_len);
+            if (sim.baud)
+                LeaveCriticalSection(&sim.bus);
+            if (req[0] == 0) {
+                // Unit 0 is broadcast: no response
+            } else if (sim.reorder_ms && !sim.rtu && !held_len && req[1] >= 0x01 && req[1] <= 0x04) {
+                // Data read before the next request, sent after its response: as a gateway with parallel buses
+                memcpy(held, out, out_len);
+                held_len = out_len;
+                held_until_us = time_us() + sim.reorder_ms * 1000ULL;
+            } else {
+                if (send_all(sock, out, out_len) != out_len)
+                    goto closed;
+                if (held_len && send_all(sock, held, held_len) != held_len)
+                    goto closed;
+                held_len = 0;
+            }
+
+            in_len -= frame_len;
+            memmove(in, in + frame_len, in_len);
+        }
+    }
+closed:
+    closesocket(sock);
+    return 0;
+}
+
+int sim_main(int argc, char* argv[]) {
+    if (argc < 2 || (strcmp(argv[0], "tcp") != 0 && strcmp(argv[0], "rtu") != 0)) {
+        log_ln("Usage: sim tcp|rtu <port> [delay_ms] [baud] [reorder_ms]");
+        return 1;
+    }
+    sim.rtu = strcmp(argv[0], "rtu") == 0;
+    int port = atoi(argv[1]);
+    sim.delay_ms = argc > 2 ? atoi(argv[2]) : 0;
+    sim.baud = argc > 3 ? atoi(argv[3]) : 0;
+    sim.reorder_ms = argc > 4 && !sim.rtu ? atoi(argv[4]) : 0;
+    for (int i = 0; i < 65536; i++)
+        sim.registers[i] = (uint16_t)i;
+    InitializeCriticalSection(&sim.bus);
+    timeBeginPeriod(1);             // Millisecond Sleep() for the response delay
+
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2,2), &wsa);
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr = {AF_INET, htons(port), INADDR_ANY};
+    if (listener == INVALID_SOCKET || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR
+            || listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+        log_efln("Simulator listen on port %d failed: %s", port, GetLastErrorString(FALSE));
+        WSACleanup();
+        return 1;
+    }
+    log_fln("Simulating %s slave on port %d, delay %d ms, baud %d, reorder %d ms", sim.rtu ? "RTU over TCP" : "Modbus TCP",
+        port, sim.delay_ms, sim.baud, sim.reorder_ms);
+
+    for (;;) {
+        SOCKET client = accept(listener, NULL, NULL);
+        if (client == INVALID_SOCKET)
+            continue;
+        HANDLE thread = CreateThread(NULL, 0, sim_connection, (LPVOID)(uintptr_t)client, 0, NULL);
+        if (thread)
+            CloseHandle(thread);
+        else
+            closesocket(client);
+    }
+}
@@ -0,0 +1,20 @@
+/*
+ * File   : sim.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the Modbus slave simulator, the far end of
+ *               the loopback benchmark (see bench.h, bench.cmd)
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+/// @brief Run slave simulator until the process is stopped
+/// @brief Arguments: tcp|rtu <port> [delay_ms] [baud] [reorder_ms]
+/// @param argc Number of arguments behind "sim"
+/// @param argv Arguments behind "sim"
+/// @return Exit code
+int sim_main(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * File   : stats.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of latency histograms, error counters and
+ *               their Prometheus text format
+ */
+
+#include "stats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "comm.h"
+
+
+/// @brief Largest value (us) counted in bucket
+static uint64_t histogram_upper(int bucket) {
+    if (bucket < (1 << HISTOGRAM_SUB_BITS))
+        return bucket;
+    int msb = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS -1;
+    uint64_t sub = bucket & ((1 << HISTOGRAM_SUB_BITS) -1);
+    return (((1ULL << HISTOGRAM_SUB_BITS) + sub +1) << (msb - HISTOGRAM_SUB_BITS)) -1;
+}
+
+void error_count(struct error_counters* e, int error) {
+    switch (error) {
+        case enSIMPLE_TCP_error_crc:            e->crc++; break;
+        case enSIMPLE_TCP_error_timeout:        e->timeout++; break;
+        case enSIMPLE_TCP_error_tooMuchData:    e->too_much_data++; break;
+        case enSIMPLE_TCP_error_bufferFull:     e->buffer_full++; break;
+        case enSIMPLE_TCP_disconnected:         e->disconnected++; break;
+        default: break;
+    }
+}
+
+void histogram_add(struct histogram* sum, const struct histogram* h) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        sum->buckets[i] += h->buckets[i];
+    sum->count += h->count;
+    sum->sum_us += h->sum_us;
+}
+
+uint64_t histogram_percentile(const struct histogram* h, double quantile) {
+    uint64_t rank = (uint64_t)(quantile * h->count + 0.5);
+    uint64_t cumulative = 0;
+    if (!h->count)
+        return 0;
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        cumulative += h->buckets[i];
+        if (cumulative >= rank)
+            return histogram_upper(i);
+    }
+    return histogram_upper(HISTOGRAM_BUCKETS -1);
+}
+
+void error_counters_add(struct error_counters* sum, const struct error_counters* e) {
+    sum->crc += e->crc;
+    sum->timeout += e->timeout;
+    sum->too_much_data += e->too_much_data;
+    sum->buffer_full += e->buffer_full;
+    sum->transaction_mismatch += e->transaction_mismatch;
+    sum->disconnected += e->disconnected;
+    sum->reconnects += e->reconnects;
+}
+
+void text_printf(struct text* t, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        size_t room = t->capacity - t->len;
+        va_start(args, format);
+        int n = t->data ? vsnprintf(t->data + t->len, room, format, args) : -1;
+        va_end(args);
+        if (n >= 0 && (size_t)n < room) {
+            t->len += n;
+            return;
+        }
+        size_t capacity = t->capacity ? t->capacity *2 : 4096;
+        char* grown = realloc(t->data, capacity);
+        if (!grown)
+            return;                 // Truncated output rather than none
+        t->data = grown;
+        t->capacity = capacity;
+    }
+}
+
+void stats_write_histogram(struct text* t, const char* name, const char* labels, const struct histogram* h) {
+    const char* sep = labels[0] ? "," : "";
+    uint64_t cumulative = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS -1; i++) {
+        cumulative += h->buckets[i];
+        text_printf(t, "%s_bucket{%s%sle=\"%.6f\"} %llu\n", name, labels, sep,
+            histogram_upper(i) / 1e6, (unsigned long long)cumulative);
+    }
+    text_printf(t, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)h->count);
+    const char* open = labels[0] ? "{" : "";
+    const char* close = labels[0] ? "}" : "";
+    text_printf(t, "%s_sum%s%s%s %.6f\n", name, open, labels, close, h->sum_us / 1e6);
+    text_printf(t, "%s_count%s%s%s %llu\n", name, open, labels, close, (unsigned long long)h->count);
+}
+
+void stats_write_errors(struct text* t, const char* name, const char* labels, const struct error_counters* e) {
+    const char* sep = labels[0] ? "," : "";
+    struct { const char* type; uint64_t value; } types[] = {
+        { "crc", e->crc },
+        { "timeout", e->timeout },
+        { "too_much_data", e->too_much_data },
+        { "buffer_full", e->buffer_full },
+        { "transaction_mismatch", e->transaction_mismatch },
+        { "disconnected", e->disconnected },
+        { "reconnect", e->reconnects },
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        text_printf(t, "%s{%s%stype=\"%s\"} %llu\n", name, labels, sep, types[i].type, (unsigned long long)types[i].value);
+}
@@ -0,0 +1,112 @@
+/*
+ * File   : stats.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Definitions for latency histograms and error counters.
+ *               Every histogram/counter set has exactly one writing thread
+ *               (target worker or reactor thread), so recording is a plain
+ *               increment without lock or atomic. Readers (metrics endpoint)
+ *               read the aligned 64 bit values concurrently.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <windows.h>
+
+// Log-linear buckets: 4 sub-buckets per power of two of microseconds, up to 2^27 us (134 s),
+// the last bucket also takes everything above
+#define HISTOGRAM_SUB_BITS  2
+#define HISTOGRAM_BUCKETS   (26 << HISTOGRAM_SUB_BITS)
+
+
+/// @brief Latency histogram (HDR style, ~19% relative bucket width)
+struct histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+};
+
+/// @brief Error events of one side (master connections of a reactor, or a target)
+struct error_counters {
+    uint64_t crc;
+    uint64_t timeout;
+    uint64_t too_much_data;
+    uint64_t buffer_full;
+    uint64_t transaction_mismatch;  // Response with unexpected transaction ID / unit / function code
+    uint64_t disconnected;
+    uint64_t reconnects;
+};
+
+/// @brief Growing text buffer for the metrics exposition
+struct text {
+    char* data;
+    size_t len;
+    size_t capacity;
+};
+
+
+/// @brief Bucket index of a value
+static inline int histogram_bucket(uint64_t us) {
+    if (us < (1 << HISTOGRAM_SUB_BITS))
+        return (int)us;
+    unsigned long msb;
+    _BitScanReverse64(&msb, us);
+    int bucket = ((msb - HISTOGRAM_SUB_BITS +1) << HISTOGRAM_SUB_BITS)
+        + (int)((us >> (msb - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) -1));
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS -1;
+}
+
+/// @brief Record a latency (owning thread only)
+/// @param h Histogram
+/// @param us Latency in microseconds
+static inline void histogram_record(struct histogram* h, uint64_t us) {
+    h->buckets[histogram_bucket(us)]++;
+    h->count++;
+    h->sum_us += us;
+}
+
+/// @brief Count an error (owning thread only)
+/// @param e Counters
+/// @param error Error code (see enSIMPLE_TCP)
+void error_count(struct error_counters* e, int error);
+
+/// @brief Add histogram to another (for summing up the per-thread histograms)
+/// @param sum Target of the sum
+/// @param h Histogram to add
+void histogram_add(struct histogram* sum, const struct histogram* h);
+
+/// @brief Latency below which a share of the recorded values lies (upper bound of its bucket)
+/// @param h Histogram
+/// @param quantile Share, e.g. 0.99
+/// @return Latency in us, 0 if empty
+uint64_t histogram_percentile(const struct histogram* h, double quantile);
+
+/// @brief Add error counters to others (for summing up the per-thread counters)
+/// @param sum Target of the sum
+/// @param e Counters to add
+void error_counters_add(struct error_counters* sum, const struct error_counters* e);
+
+/// @brief Append formatted text, grows the buffer
+/// @param t Text buffer
+/// @param format printf format
+void text_printf(struct text* t, const char* format, ...);
+
+/// @brief Append histogram in Prometheus text format (buckets in seconds, cumulative)
+/// @param t Text buffer
+/// @param name Metric name without suffix
+/// @param labels Labels without braces (e.g. target="host:502"), "" for none
+/// @param h Histogram
+void stats_write_histogram(struct text* t, const char* name, const char* labels, const struct histogram* h);
+
+/// @brief Append error counters in Prometheus text format as name{labels,type="..."}
+/// @param t Text buffer
+/// @param name Metric name
+/// @param labels Labels without braces
+/// @param e Counters
+void stats_write_errors(struct text* t, const char* name, const char* labels, const struct error_counters* e);
+
+#endif
@@ -0,0 +1,995 @@
+/*
+ * File   : target.c
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Implementation of the shared upstream connection to a target.
+ *               One worker thread per target owns the socket, takes the
+ *               queued transactions in order and does the round trip.
+ *               RTU targets get one request at a time, Modbus TCP targets
+ *               up to `--window` outstanding ones, routed by transaction ID.
+ *               Broadcasts (unit 0) are sent without waiting for a response,
+ *               reads above the unit's max quantity are split and joined.
+ *               Frames to RTU targets with a known baud rate are paced to
+ *               the serial line behind the converter.
+ */
+
+#include "target.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ws2tcpip.h>
+
+#include "main.h"
+#include "cli.h"
+#include "crc.h"
+#include "endian.h"
+#include "config.h"
+#include "frame.h"
+#include "poll.h"
+#include "capture.h"
+#include "image.h"
+
+
+#define STATS_INTERVAL_US   (60 * 1000000ULL)
+#define RECONNECT_MIN_MS    1000
+#define RECONNECT_MAX_MS    30000
+#define IDLE_CHECK_US       (1000 * 1000ULL)   // Check connection idle this long before using it
+#define WEIGHT_SCALE        1000                // Virtual time per byte at weight 1
+#define BUS_FAST_BAUD       19200               // Above it the inter-frame gap is fixed
+#define BUS_FAST_GAP_US     1750
+
+#pragma comment(lib, "winmm.lib")
+
+
+static DWORD WINAPI target_thread(LPVOID lpParam);
+
+static volatile LONG timer_holders = 0;        // Paced targets, timeBeginPeriod(1) while there are any
+
+
+/// @brief Read above the max quantity of its unit, queued as parts and joined into the master's response
+struct split {
+    struct transaction* tx;         // Master's read
+    volatile LONG pending;          // Parts not completed yet, the last one joins
+    int count;
+    struct split_part {
+        struct transaction tx;
+        uint8_t req[6];
+        uint16_t offset;            // Of the part within the master's read
+        uint16_t quantity;
+    } parts[];
+};
+
+
+/// @brief Hold the 1 ms timer resolution for the inter-frame gaps while the target is paced, the
+/// @brief system-wide setting is given back with the last paced target
+static void target_timer_resolution(struct target* t, boolean paced) {
+    if (t->timer_held == paced)
+        return;
+    t->timer_held = paced;
+    if (paced && InterlockedIncrement(&timer_holders) == 1)
+        timeBeginPeriod(1);
+    else if (!paced && InterlockedDecrement(&timer_holders) == 0)
+        timeEndPeriod(1);
+}
+
+/// @brief Release target that failed to start
+static void target_free(struct target* t) {
+    target_timer_resolution(t, FALSE);
+    if (t->wakeup)
+        CloseHandle(t->wakeup);
+    if (t->sock_event != WSA_INVALID_EVENT)
+        WSACloseEvent(t->sock_event);
+    free(t->cache);
+    free(t->slots);
+    DeleteCriticalSection(&t->lock);
+    free(t);
+}
+
+struct target* target_create(const char* host, int port, boolean rtu) {
+    struct target* t = calloc(1, sizeof(struct target));
+    if (!t) {
+        log_efln("target_create malloc failed: %s", GetLastErrorString(FALSE));
+        return NULL;
+    }
+    strncpy(t->host, host, sizeof(t->host) -1);
+    t->port = port;
+    t->rtu = rtu;
+    t->sock = INVALID_SOCKET;
+    t->transactionId = 1;
+    t->stats_logged_us = time_us();
+    t->capture_id = capture_conn_id();
+    t->routed = TRUE;
+    t->slot_count = rtu ? 1 : CONFIG_MAX_WINDOW;   // A reload may widen the window
+    InitializeCriticalSection(&t->lock);
+    t->wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+    t->sock_event = rtu ? WSA_INVALID_EVENT : WSACreateEvent();
+    t->slots = calloc(t->slot_count, sizeof(struct slot));
+
+    if (!t->wakeup || (!rtu && t->sock_event == WSA_INVALID_EVENT) || !t->slots) {
+        log_efln("target_create failed: %s", GetLastErrorString(FALSE));
+        target_free(t);
+        return NULL;
+    }
+    target_configure(t);
+
+    t->thread = CreateThread(NULL, 0, target_thread, t, 0, NULL);
+    if (!t->thread) {
+        log_efln("target_create CreateThread failed: %lu", GetLastError());
+        target_free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void target_configure(struct target* t) {
+    const struct config* cfg = config();
+    t->window = t->rtu ? 1 : cfg->window;  // Worker stops filling above it, outstanding ones finish
+    int baud = 0, char_bits;
+    if (t->rtu)
+        config_bus(t->host, t->port, &baud, &char_bits);
+    t->char_ns = baud ? (uint32_t)(char_bits * 1000000000ULL / baud) : 0;
+    t->gap_us = baud > BUS_FAST_BAUD ? BUS_FAST_GAP_US : t->char_ns * 7 / 2000;
+    target_timer_resolution(t, baud != 0);  // Millisecond Sleep() for the gaps
+    if (!t->cache && (cfg->cache_ttl_ms > 0 || cfg->cache_rule_count > 0))
+        t->cache = cache_create();          // Published once, never freed while running
+}
+
+/// @brief Weighted fair queuing tags: the request starts at the later of the target's virtual time
+/// @brief and the finish of the master's previous one, its size on the wire divided by the master's
+/// @brief weight gives the finish it is sent by. A small request of a quiet master is sent before
+/// @brief the large ones of a busy master, a busy master only gets its share (lock held)
+static void target_tag(struct target* t, struct transaction* tx) {
+    struct flow* f = tx->flow;
+    int weight = 1;
+    tx->start = t->vtime;
+    if (f) {
+        if (f->target == t && f->finish > tx->start)
+            tx->start = f->finish;
+        weight = f->weight;
+    }
+    tx->finish = tx->start + (uint64_t)rto_size(tx->req, tx->req_len) * WEIGHT_SCALE / weight;
+    if (f) {
+        f->target = t;
+        f->finish = tx->finish;
+    }
+}
+
+/// @brief Join the responses of all parts into the response of the master's read, the first error
+/// @brief or exception of a part answers the whole read
+/// @return >0 Length of response, <=0 error (see enSIMPLE_TCP)
+static int split_join(struct split* sp) {
+    const uint8_t* req = sp->tx->req;
+    uint8_t* rsp = sp->tx->rsp;
+    uint8_t function_code = req[1];
+    int pdu_len = expected_pdu_length(function_code, read_uint16_reverse(req +4));
+
+    memset(rsp, 0, 1 + pdu_len);
+    for (int i = 0; i < sp->count; i++) {
+        const struct split_part* p = &sp->parts[i];
+        int part_pdu_len = expected_pdu_length(function_code, p->quantity);
+        if (p->tx.rsp_len <= 0)
+            return p->tx.rsp_len;
+        if (p->tx.rsp_len == 3 && p->tx.rsp[1] == (function_code | 0x80)) {
+            memcpy(rsp, p->tx.rsp, 3);
+            return 3;
+        }
+        if (p->tx.rsp[1] != function_code || p->tx.rsp_len != 1 + part_pdu_len || p->tx.rsp[2] != part_pdu_len -2)
+            return enSIMPLE_TCP_error_tooMuchData;
+        if (function_code == 0x03 || function_code == 0x04) {
+            memcpy(rsp +3 + p->offset*2, p->tx.rsp +3, p->quantity*2);
+        } else {
+            for (uint16_t b = 0; b < p->quantity; b++) {
+                int bit = p->offset + b;
+                if (p->tx.rsp[3 + b/8] & (1 << (b%8)))
+                    rsp[3 + bit/8] |= 1 << (bit%8);
+            }
+        }
+        io_count_copy(part_pdu_len -2);
+    }
+    rsp[0] = req[0];
+    rsp[1] = function_code;
+    rsp[2] = pdu_len -2;                // Byte count
+    return 1 + pdu_len;
+}
+
+/// @brief Completion of a part, the last one completes the master's read (any thread)
+static void split_done(struct transaction* part) {
+    struct split* sp = part->context;
+    if (InterlockedDecrement(&sp->pending))
+        return;
+    struct transaction* tx = sp->tx;
+    tx->rsp_len = split_join(sp);
+    tx->enqueued_us = sp->parts[0].tx.enqueued_us;  // Queue wait of the read is that of its first part
+    tx->taken_us = sp->parts[0].tx.taken_us;
+    free(sp);
+    tx->done(tx);
+}
+
+/// @brief Queue a read above the max quantity of its unit as parts, back to back in one flow
+/// @return TRUE if split, FALSE to queue tx as it is
+static boolean target_split(struct target* t, struct transaction* tx) {
+    if (tx->req_len != 6 || tx->req[0] == MODBUS_BROADCAST_UNIT || !read_max_quantity(tx->req[1]))
+        return FALSE;
+    int max = config_max_quantity(tx->req[0], tx->req[1]);
+    uint16_t address = read_uint16_reverse(tx->req +2);
+    uint16_t quantity = read_uint16_reverse(tx->req +4);
+    if (!max || quantity <= max || quantity > read_max_quantity(tx->req[1]))
+        return FALSE;           // Invalid quantities get the slave's exception
+
+    int count = (quantity + max -1) / max;
+    struct split* sp = malloc(sizeof(struct split) + count * sizeof(struct split_part));
+    if (!sp) {
+        log_efln("Split malloc failed: %s", GetLastErrorString(FALSE));
+        return FALSE;
+    }
+    sp->tx = tx;
+    sp->pending = count;
+    sp->count = count;
+    for (int i = 0; i < count; i++) {
+        struct split_part* p = &sp->parts[i];
+        p->offset = (uint16_t)(i * max);
+        p->quantity = (uint16_t)(quantity - p->offset < max ? quantity - p->offset : max);
+        p->req[0] = tx->req[0];
+        p->req[1] = tx->req[1];
+        write_uint16_reverse(p->req +2, address + p->offset);
+        write_uint16_reverse(p->req +4, p->quantity);
+        p->tx.req = p->req;
+        p->tx.req_len = 6;
+        p->tx.deadline_us = tx->deadline_us;
+        p->tx.flow = tx->flow;
+        p->tx.done = split_done;
+        p->tx.context = sp;
+    }
+    InterlockedIncrement64(&t->splits);
+
+    // sp is freed by the completion of the last part
+    struct split_part* parts = sp->parts;
+    for (int i = 0; i < count; i++)
+        target_submit(t, &parts[i].tx);
+    return TRUE;
+}
+
+void target_submit(struct target* t, struct transaction* tx) {
+    if (target_split(t, tx))
+        return;
+    tx->next = NULL;
+    tx->rsp_len = 0;
+    tx->enqueued_us = time_us();
+    tx->taken_us = 0;
+    InterlockedIncrement64(&io_counters.transactions);
+
+    if (t->cache && (tx->rsp_len = cache_lookup(t->cache, tx->req, tx->req_len, tx->rsp)) > 0) {
+        io_count_copy(tx->rsp_len);
+        tx->done(tx);
+        return;
+    }
+
+    EnterCriticalSection(&t->lock);
+    target_tag(t, tx);
+    if (t->tail)
+        t->tail->next = tx;
+    else
+        t->head = tx;
+    t->tail = tx;
+    LONG depth = InterlockedIncrement(&t->queue_depth);
+    if (depth > t->queue_depth_max)
+        t->queue_depth_max = depth;
+    LeaveCriticalSection(&t->lock);
+    SetEvent(t->wakeup);
+}
+
+static void transact_done(struct transaction* tx) {
+    SetEvent((HANDLE)tx->context);
+}
+
+int target_transact(struct target* t, struct transaction* tx, HANDLE event) {
+    tx->done = transact_done;
+    tx->context = event;
+    tx->flow = NULL;
+    tx->deadline_us = 0;
+    target_submit(t, tx);
+    WaitForSingleObject(event, INFINITE);
+    return tx->rsp_len;
+}
+
+void target_log_stats(struct target* t) {
+    EnterCriticalSection(&t->lock);
+    uint64_t transactions = t->transactions;
+    uint64_t wait_avg = transactions ? t->wait_us_total / transactions : 0;
+    uint64_t wait_max = t->wait_us_max;
+    uint64_t coalesced = t->coalesced;
+    LONG depth_max = t->queue_depth_max;
+    LeaveCriticalSection(&t->lock);
+
+    log_ifln("Target %s:%d: %llu transactions (%llu coalesced), queue depth %ld (max %ld), wait avg %llu us (max %llu us)",
+        t->host, t->port, (unsigned long long)transactions, (unsigned long long)coalesced, t->queue_depth, depth_max,
+        (unsigned long long)wait_avg, (unsigned long long)wait_max);
+    if (!t->rtu)
+        log_ifln("Target %s:%d: window %d, in flight max %d, %llu timeouts, %llu unknown transaction IDs",
+            t->host, t->port, t->window, t->inflight_max,
+            (unsigned long long)t->errors.timeout, (unsigned long long)t->errors.transaction_mismatch);
+    if (t->dropped)
+        log_ifln("Target %s:%d: %llu requests dropped, queued past --master-timeout",
+            t->host, t->port, (unsigned long long)t->dropped);
+    if (t->broadcasts)
+        log_ifln("Target %s:%d: %llu broadcasts", t->host, t->port, (unsigned long long)t->broadcasts);
+    if (t->splits)
+        log_ifln("Target %s:%d: %lld reads split at --max-quantity", t->host, t->port, (long long)t->splits);
+    if (t->char_ns) {
+        uint64_t interval_us = time_us() - t->stats_logged_us;
+        log_ifln("Target %s:%d: bus utilization %.1f%% since last log, %.1f s on the wire, %.1f s held back for the line",
+            t->host, t->port, interval_us ? 100.0 * (t->bus_busy_us - t->bus_busy_logged_us) / interval_us : 0.0,
+            t->bus_wire_us / 1e6, t->bus_held_us / 1e6);
+    }
+    if (!config()->timeout_ms && t->rto.samples)
+        log_ifln("Target %s:%d: one register read RTT %llu us (smoothed), timeout %llu us",
+            t->host, t->port, (unsigned long long)rto_srtt_us(&t->rto, RTO_REFERENCE_SIZE),
+            (unsigned long long)rto_timeout_us(&t->rto, RTO_REFERENCE_SIZE, 0));
+    if (t->cache)
+        log_ifln("Target %s:%d: cache %lld hits, %lld misses, %lld invalidations",
+            t->host, t->port, (long long)t->cache->hits, (long long)t->cache->misses, (long long)t->cache->invalidations);
+
+    LONG64 io_transactions = io_counters.transactions;
+    if (io_transactions)
+        log_ifln("I/O (all targets): %.1f bytes copied, %.2f send/recv calls per transaction",
+            (double)io_counters.bytes_copied / io_transactions, (double)io_counters.syscalls / io_transactions);
+}
+
+
+
+/// @brief Connect socket to target
+/// @return 0 if OK, <0 error (see enSIMPLE_TCP)
+static int target_connect(struct target* t) {
+    struct addrinfo hints = {0}, *res = NULL;
+    char port[8];
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf(port, "%d", t->port);
+    if (getaddrinfo(t->host, port, &hints, &res) != 0 || !res) {
+        log_efln("Target %s:%d address resolution failed: %s", t->host, t->port, GetLastErrorString(FALSE));
+        t->errors.disconnected++;
+        return enSIMPLE_TCP_disconnected;
+    }
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    DWORD timeout = t->rtu ? RTU_TIMEOUT : TCP_TIMEOUT;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)))
+        log_efln("Error setsockopt(slave, timeout) %s", GetLastErrorString(FALSE));
+    if (setSocketKeepAlive(sock, TRUE))
+        log_efln("Error setSocketKeepAlive(slave) %s", GetLastErrorString(FALSE));
+    BOOL nodelay = TRUE;        // Pipelined requests go out back to back
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay)))
+        log_efln("Error setsockopt(slave, nodelay) %s", GetLastErrorString(FALSE));
+
+    int result = connect(sock, res->ai_addr, (int)res->ai_addrlen);
+    freeaddrinfo(res);
+    if (result != 0) {
+        log_efln("Target %s:%d connect failed: %s", t->host, t->port, GetLastErrorString(FALSE));
+        closesocket(sock);
+        t->errors.disconnected++;
+        return enSIMPLE_TCP_disconnected;
+    }
+    if (!t->rtu && WSAEventSelect(sock, t->sock_event, FD_READ | FD_CLOSE) == SOCKET_ERROR) {
+        log_efln("Target %s:%d WSAEventSelect failed: %s", t->host, t->port, GetLastErrorString(FALSE));
+        closesocket(sock);
+        return enSIMPLE_TCP_disconnected;
+    }
+    t->rcv_timeout_ms = timeout;
+    log_sfln("Target %s:%d connected", t->host, t->port);
+    if (t->connects++)
+        t->errors.reconnects++;
+    t->sock = sock;
+    t->rx_len = 0;
+    t->rtu_rx.len = 0;
+    return 0;
+}
+
+static void target_disconnect(struct target* t) {
+    if (t->sock != INVALID_SOCKET) {
+        closesocket(t->sock);
+        t->sock = INVALID_SOCKET;
+    }
+}
+
+/// @brief Drop the idle connection if the target closed it, discard unsolicited data
+static void target_check_idle(struct target* t) {
+    WSAPOLLFD pfd = { t->sock, POLLRDNORM, 0 };
+    if (WSAPoll(&pfd, 1, 0) <= 0)
+        return;
+    char byte;
+    if (recv(t->sock, &byte, 1, MSG_PEEK) <= 0) {
+        log_wfln("Target %s:%d closed idle connection", t->host, t->port);
+        t->errors.disconnected++;
+        target_disconnect(t);
+    } else {
+        log_wfln("Target %s:%d: %d unsolicited bytes dropped", t->host, t->port, clear_socket_in_buffer(t->sock));
+        t->rx_len = 0;
+        t->rtu_rx.len = 0;
+    }
+}
+
+/// @brief Health check of the connection before it is used again after a pause
+static void target_check_before_use(struct target* t) {
+    if (t->sock != INVALID_SOCKET && time_us() - t->used_us >= IDLE_CHECK_US)
+        target_check_idle(t);
+    t->used_us = time_us();
+}
+
+/// @brief Keep the idle connection usable: health check, (re)connect in the background with backoff (--prewarm)
+static void target_keep_warm(struct target* t) {
+    if (t->sock != INVALID_SOCKET)
+        target_check_idle(t);
+
+    if (!config()->prewarm || !t->routed || t->sock != INVALID_SOCKET || isStop())
+        return;
+    uint64_t now = time_us();
+    if (now < t->reconnect_us)
+        return;
+    if (target_connect(t) == 0) {
+        t->reconnect_backoff_ms = 0;
+    } else {
+        t->reconnect_backoff_ms = t->reconnect_backoff_ms ? t->reconnect_backoff_ms * 2 : RECONNECT_MIN_MS;
+        if (t->reconnect_backoff_ms > RECONNECT_MAX_MS)
+            t->reconnect_backoff_ms = RECONNECT_MAX_MS;
+        t->reconnect_us = now + t->reconnect_backoff_ms * 1000ULL;
+    }
+}
+
+/// @brief Estimator the timeout of a request is taken from, a unit without samples starts at the initial timeout
+static struct rto_estimator* target_rto(struct target* t, const uint8_t* req) {
+    return config()->timeout_per_unit ? &t->rto_units[req[0]] : &t->rto;
+}
+
+/// @brief Response timeout for the request of tx, fixed (--timeout=<ms>) or estimated
+static uint64_t target_timeout_us(struct target* t, const struct transaction* tx) {
+    if (config()->timeout_ms)
+        return config()->timeout_ms * 1000ULL;
+    return rto_timeout_us(target_rto(t, tx->req), rto_size(tx->req, tx->req_len),
+        (t->rtu ? RTU_TIMEOUT : TCP_TIMEOUT) * 1000ULL);
+}
+
+/// @brief Record round trip of an answered request
+static void target_rtt(struct target* t, const struct transaction* tx, uint64_t rtt_us) {
+    int size = rto_size(tx->req, tx->req_len);
+    histogram_record(&t->rtt, rtt_us);
+    rto_sample(&t->rto, rtt_us, size);
+    rto_sample(&t->rto_units[tx->req[0]], rtt_us, size);
+}
+
+/// @brief Round trip to a RTU over TCP target: send request with CRC, receive response into tx->rsp
+/// @return >0 Length of response (without CRC), <0 error (see enSIMPLE_TCP)
+static int exchange_rtu(struct target* t, struct transaction* tx) {
+    uint8_t crc[2];
+    uint16_t crc_calc = crc16(tx->req, tx->req_len);
+    memcpy(crc, &crc_calc, sizeof(crc));
+
+    WSABUF bufs[2] = { { tx->req_len, (char*)tx->req }, { sizeof(crc), (char*)crc } };
+    capture_frame(t->capture_id, CAPTURE_OUT | CAPTURE_RTU, bufs, 2);
+    int snd_len = send_gather(t->sock, bufs, 2);
+    if (snd_len <= 0) {
+        error_count(&t->errors, snd_len);
+        return snd_len < 0 ? snd_len : enSIMPLE_TCP_disconnected;
+    }
+    if (tx->req[0] == MODBUS_BROADCAST_UNIT) {
+        // No slave answers, the bus is free once they had time to process it
+        t->broadcasts++;
+        Sleep(config()->broadcast_delay_ms);
+        target_check_idle(t);   // Drop the answer of a slave that responds anyway
+        return enSIMPLE_TCP_broadcast;
+    }
+
+    // SO_RCVTIMEO only changes if the timeout grows or shrinks by more than 1/8
+    DWORD timeout = (DWORD)((target_timeout_us(t, tx) + 999) / 1000);
+    if ((timeout > t->rcv_timeout_ms || timeout < t->rcv_timeout_ms - t->rcv_timeout_ms / 8)
+            && setsockopt(t->sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)) == 0)
+        t->rcv_timeout_ms = timeout;
+
+    uint64_t sent_us = time_us();
+    int rcv_len = recv_rtu(t->sock, &t->rtu_rx, tx->rsp);
+    if (rcv_len <= 0) {
+        error_count(&t->errors, rcv_len);
+        if (rcv_len == enSIMPLE_TCP_error_crc)
+            capture_dump_error("target RTU CRC error");
+        if (rcv_len == enSIMPLE_TCP_error_timeout)
+            rto_backoff(target_rto(t, tx->req));
+        return rcv_len;
+    }
+    capture_bytes(t->capture_id, CAPTURE_RTU, tx->rsp, rcv_len);
+    int expected_pdu_len = tx->rsp[1] & 0x80 ? -1 : expected_pdu_length(tx->req[1], tx->req[4]<<8 | tx->req[5]);
+    if (tx->rsp[0] != tx->req[0] || (tx->rsp[1] & 0x7F) != tx->req[1]
+            || (expected_pdu_len >= 0 && rcv_len != expected_pdu_len + 3)) {
+        log_efln("RTU response mismatch: unit %u fc 0x%02X len %d for unit %u fc 0x%02X",
+            tx->rsp[0], tx->rsp[1], rcv_len, tx->req[0], tx->req[1]);
+        t->errors.transaction_mismatch++;
+        capture_dump_error("RTU response mismatch");
+        return enSIMPLE_TCP_error_tooMuchData;  // Desync
+    }
+    target_rtt(t, tx, time_us() - sent_us);
+    return rcv_len -2;                          // CRC weg
+}
+
+/// @brief Account queue wait of a transaction taken out of the queue (lock held)
+static void target_account(struct target* t, struct transaction* tx) {
+    InterlockedDecrement(&t->queue_depth);
+
+    uint64_t wait_us = time_us() - tx->enqueued_us;
+    t->transactions++;
+    t->wait_us_total += wait_us;
+    if (wait_us > t->wait_us_max)
+        t->wait_us_max = wait_us;
+    histogram_record(&t->queue_wait, wait_us);
+    histogram_record(&t->class_wait[tx->flow ? tx->flow->priority : 0], wait_us);
+    tx->taken_us = tx->enqueued_us + wait_us;   // The flow's histogram is written by its reactor
+}
+
+/// @brief Take the next request out of the queue: highest priority class first, smallest finish tag
+/// @brief within the class, FIFO on equal tags. Requests past their deadline are moved to expired (lock held)
+/// @param t Target
+/// @param expired List of dropped requests (linked by next), to be completed without the lock
+/// @return Request or NULL if none left
+static struct transaction* target_pick(struct target* t, struct transaction** expired) {
+    uint64_t now = time_us();
+    struct transaction* best = NULL;
+    struct transaction* best_prev = NULL;
+    struct transaction* prev = NULL;
+    struct transaction* cur = t->head;
+
+    while (cur) {
+        struct transaction* next = cur->next;
+        if (cur->deadline_us && cur->deadline_us <= now) {
+            if (prev)
+                prev->next = next;
+            else
+                t->head = next;
+            if (t->tail == cur)
+                t->tail = prev;
+            InterlockedDecrement(&t->queue_depth);
+            cur->next = *expired;
+            *expired = cur;
+            cur = next;
+            continue;
+        }
+        int priority = cur->flow ? cur->flow->priority : 0;
+        int best_priority = best && best->flow ? best->flow->priority : 0;
+        if (!best || priority > best_priority || (priority == best_priority && cur->finish < best->finish)) {
+            best = cur;
+            best_prev = prev;
+        }
+        prev = cur;
+        cur = next;
+    }
+    if (!best)
+        return NULL;
+
+    if (best_prev)
+        best_prev->next = best->next;
+    else
+        t->head = best->next;
+    if (t->tail == best)
+        t->tail = best_prev;
+    if (best->start > t->vtime)
+        t->vtime = best->start;
+    return best;
+}
+
+/// @brief Check transaction is a read that can be merged with others (0x01-0x04)
+static int coalescable(const struct transaction* tx) {
+    return tx->req_len == 6 && read_max_quantity(tx->req[1]) > 0 && tx->req[0] != MODBUS_BROADCAST_UNIT;
+}
+
+/// @brief Take queued reads of the same unit and function code out of the queue,
+/// @brief which overlap or adjoin tx and together stay within the PDU limit (lock held)
+/// @param t Target
+/// @param tx Transaction already taken out of the queue, becomes head of the group (linked by next)
+/// @param address Start address of the covering read
+/// @param quantity Quantity of the covering read
+/// @return Number of transactions in the group
+static int target_coalesce(struct target* t, struct transaction* tx, uint16_t* address, uint16_t* quantity) {
+    tx->next = NULL;
+    if (!config()->coalesce || !coalescable(tx))
+        return 1;
+
+    uint32_t start = read_uint16_reverse(tx->req +2);
+    uint32_t end = start + read_uint16_reverse(tx->req +4);
+    uint32_t max = read_max_quantity(tx->req[1]);
+    uint32_t unit_max = config_max_quantity(tx->req[0], tx->req[1]);
+    if (unit_max && unit_max < max)
+        max = unit_max;             // Never merge the parts of a split read again
+    struct transaction* last = tx;
+    int count = 1;
+    int changed;
+
+    do {
+        changed = 0;
+        struct transaction* prev = NULL;
+        struct transaction* cur = t->head;
+        while (cur) {
+            struct transaction* next = cur->next;
+            if (cur->req[0] == tx->req[0] && !coalescable(cur))
+                break;              // Keep reads behind a write to the same unit behind it
+            uint32_t cur_start = read_uint16_reverse(cur->req +2);
+            uint32_t cur_end = cur_start + read_uint16_reverse(cur->req +4);
+            uint32_t new_start = cur_start < start ? cur_start : start;
+            uint32_t new_end = cur_end > end ? cur_end : end;
+            if (coalescable(cur) && cur->req[0] == tx->req[0] && cur->req[1] == tx->req[1]
+                    && cur_start <= end && start <= cur_end && new_end - new_start <= max) {
+                // Unlink from queue, append to group
+                if (prev)
+                    prev->next = next;
+                else
+                    t->head = next;
+                if (t->tail == cur)
+                    t->tail = prev;
+                target_account(t, cur);
+                cur->next = NULL;
+                last->next = cur;
+                last = cur;
+                start = new_start;
+                end = new_end;
+                count++;
+                changed = 1;
+            } else {
+                prev = cur;
+            }
+            cur = next;
+        }
+    } while (changed);
+
+    *address = start;
+    *quantity = end - start;
+    return count;
+}
+
+/// @brief Hold the next frame until the line is free: the last frames are off the wire and the gap passed
+static void bus_wait(struct target* t) {
+    if (!t->char_ns)
+        return;
+    uint64_t now = time_us();
+    if (now < t->bus_free_us) {
+        wait_us(t->bus_free_us - now);
+        t->bus_held_us += t->bus_free_us - now;
+    }
+}
+
+/// @brief Account an exchange on the line and compute when it is free again. The response was on the wire
+/// @brief before it arrived here, a request without response occupied the line at least for its own characters
+/// @param t Target
+/// @param sent_us Request sent
+/// @param req_bytes Request on the wire (with CRC)
+/// @param rsp_bytes Response on the wire (with CRC), 0 if none
+static void bus_release(struct target* t, uint64_t sent_us, int req_bytes, int rsp_bytes) {
+    uint32_t char_ns = t->char_ns;
+    if (!char_ns)
+        return;
+    uint64_t wire_us = (uint64_t)(req_bytes + rsp_bytes) * char_ns / 1000;
+    uint64_t end_us = time_us();
+    if (end_us < sent_us + wire_us)
+        end_us = sent_us + wire_us;
+    t->bus_free_us = end_us + t->gap_us;
+    t->bus_busy_us += t->bus_free_us - sent_us;
+    t->bus_wire_us += wire_us;
+}
+
+/// @brief Round trip of transaction on the shared RTU connection, connects if needed
+static void target_execute(struct target* t, struct transaction* tx) {
+    target_check_before_use(t);
+    if (t->sock == INVALID_SOCKET)
+        tx->rsp_len = target_connect(t);
+    if (t->sock != INVALID_SOCKET) {
+        bus_wait(t);
+        uint64_t sent_us = time_us();
+        tx->rsp_len = exchange_rtu(t, tx);
+        bus_release(t, sent_us, tx->req_len +2, tx->rsp_len > 0 ? tx->rsp_len +2 : 0);
+        if (tx->rsp_len <= 0 && tx->rsp_len != enSIMPLE_TCP_broadcast) {
+            log_efln("%s (%s)", simpleTcpInfoStr(tx->rsp_len, "Slave"), GetLastErrorString(FALSE));
+            target_disconnect(t);   // Reconnect on next request, protects against desync
+        }
+    }
+}
+
+/// @brief Hand finished transaction back to its master
+/// @param t Target
+/// @param tx Transaction
+/// @param cache_writes Cache write counter when its request was sent
+static void target_complete(struct target* t, struct transaction* tx, LONG64 cache_writes) {
+    if (t->cache) {
+        cache_invalidate(t->cache, tx->req, tx->req_len);   // Also on error, write might have happened
+        if (tx->rsp_len > 0)
+            cache_store(t->cache, tx->req, tx->req_len, tx->rsp, tx->rsp_len, cache_writes);
+    }
+    poll_written(tx->req, tx->req_len, tx->rsp, tx->rsp_len);
+    if (tx->flow)
+        image_transaction(tx->req, tx->req_len, tx->rsp, tx->rsp_len);    // Polled blocks come from poll.c
+    tx->done(tx);
+}
+
+/// @brief Take next request out of the queue (target_pick), merged with queued reads it covers
+/// @param t Target
+/// @param s Slot to fill (group, count, covering request)
+/// @return TRUE if a request was taken
+static boolean target_take(struct target* t, struct slot* s) {
+    uint16_t address, quantity;
+    struct transaction* expired = NULL;
+
+    EnterCriticalSection(&t->lock);
+    struct transaction* tx = target_pick(t, &expired);
+    if (tx) {
+        target_account(t, tx);
+        s->count = target_coalesce(t, tx, &address, &quantity);
+        t->coalesced += s->count -1;
+    }
+    LeaveCriticalSection(&t->lock);
+
+    // Its master has given up on it already, the bus time goes to the others
+    while (expired) {
+        struct transaction* next = expired->next;
+        t->dropped++;
+        expired->rsp_len = enSIMPLE_TCP_dropped;
+        expired->done(expired);
+        expired = next;
+    }
+
+    s->group = tx;
+    if (t->cache)
+        s->cache_writes = t->cache->writes;     // Only this thread writes it: same as at the send
+    if (!tx || s->count == 1)
+        return tx != NULL;
+
+    // One covering read for the group, sliced back out to each requester
+    s->covering_req[0] = tx->req[0];
+    s->covering_req[1] = tx->req[1];
+    s->covering_req[2] = address >> 8;
+    s->covering_req[3] = address & 0xFF;
+    s->covering_req[4] = quantity >> 8;
+    s->covering_req[5] = quantity & 0xFF;
+    s->covering.req = s->covering_req;
+    s->covering.req_len = 6;
+    s->address = address;
+    s->quantity = quantity;
+    return TRUE;
+}
+
+/// @brief Transaction actually sent upstream for slot (covering read or the single request)
+static struct transaction* slot_tx(struct slot* s) {
+    return s->count > 1 ? &s->covering : s->group;
+}
+
+/// @brief Complete all transactions of slot with the response (or error) in slot_tx() and free it
+static void target_finish(struct target* t, struct slot* s) {
+    struct transaction* tx = s->group;
+    while (tx) {
+        struct transaction* next = tx->next;
+        if (s->count > 1)
+            tx->rsp_len = s->covering.rsp_len > 0
+                ? slice_read_response(tx->req, s->covering.rsp, s->covering.rsp_len, s->address, s->quantity, tx->rsp)
+                : s->covering.rsp_len;
+        if (s->count > 1 && tx->rsp_len > 0)
+            io_count_copy(tx->rsp_len);
+        target_complete(t, tx, s->cache_writes);
+        tx = next;
+    }
+    s->group = NULL;
+}
+
+static void target_maybe_log_stats(struct target* t) {
+    if (t->transactions && time_us() - t->stats_logged_us >= STATS_INTERVAL_US) {
+        target_log_stats(t);
+        t->stats_logged_us = time_us();
+        t->bus_busy_logged_us = t->bus_busy_us;
+    }
+}
+
+/// @brief Worker for RTU over TCP targets: strictly one request at a time
+static void target_loop_rtu(struct target* t) {
+    struct slot* s = &t->slots[0];
+
+    target_keep_warm(t);
+    while (!isStop()) {
+        config_quiescent(t->config_reader);
+        if (!target_take(t, s)) {
+            if (WaitForSingleObject(t->wakeup, 1000) == WAIT_TIMEOUT) {
+                target_keep_warm(t);
+                target_maybe_log_stats(t);
+            }
+            continue;
+        }
+        target_execute(t, slot_tx(s));
+        target_finish(t, s);
+    }
+}
+
+/// @brief Send request of slot to Modbus TCP target with the next transaction ID
+/// @return >0 sent, <=0 error (see enSIMPLE_TCP)
+static int tcp_send(struct target* t, struct slot* s) {
+    struct transaction* tx = slot_tx(s);
+    uint8_t mbap[MBAP_LEN];
+
+    s->transactionId = t->transactionId++;
+    mbap[0] = s->transactionId >> 8;
+    mbap[1] = s->transactionId & 0xFF;
+    mbap[2] = 0;                        // Protocol ID
+    mbap[3] = 0;
+    mbap[4] = tx->req_len >> 8;
+    mbap[5] = tx->req_len & 0xFF;
+
+    WSABUF bufs[2] = { { MBAP_LEN, (char*)mbap }, { tx->req_len, (char*)tx->req } };
+    capture_frame(t->capture_id, CAPTURE_OUT, bufs, 2);
+    int snd_len = send_gather(t->sock, bufs, 2);
+    if (snd_len <= 0)
+        return snd_len < 0 ? snd_len : enSIMPLE_TCP_disconnected;
+    s->sent_us = time_us();
+    s->deadline_us = s->sent_us + target_timeout_us(t, tx);
+    return snd_len;
+}
+
+/// @brief Fail all outstanding transactions and close the connection
+static void tcp_fail_all(struct target* t, int error) {
+    error_count(&t->errors, error);
+    log_efln("%s (%s)", simpleTcpInfoStr(error, "Slave"), GetLastErrorString(FALSE));
+    for (int i = 0; i < t->slot_count; i++) {
+        if (t->slots[i].group) {
+            slot_tx(&t->slots[i])->rsp_len = error;
+            target_finish(t, &t->slots[i]);
+        }
+    }
+    t->inflight = 0;
+    target_disconnect(t);
+}
+
+/// @brief Read available data and route complete MBAP responses to their slot
+/// @return 0 if OK, <=0 error (see enSIMPLE_TCP)
+static int tcp_receive(struct target* t) {
+    for (;;) {
+        int len = recv(t->sock, (char*)t->rx + t->rx_len, sizeof(t->rx) - t->rx_len, 0);
+        io_count_syscall();
+        if (len == 0)
+            return enSIMPLE_TCP_disconnected;
+        if (len < 0)
+            return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : enSIMPLE_TCP_disconnected;
+        t->rx_len += len;
+
+        while (t->rx_len >= MBAP_LEN) {
+            int mbap_len = read_uint16_reverse(t->rx +4);
+            if (mbap_len < 2 || mbap_len > BUFFER_SIZE - MBAP_LEN) {
+                capture_bytes(t->capture_id, 0, t->rx, t->rx_len);
+                capture_dump_error("target MBAP length");
+                return enSIMPLE_TCP_error_tooMuchData;  // Desync
+            }
+            if (t->rx_len < MBAP_LEN + mbap_len)
+                break;
+            capture_bytes(t->capture_id, 0, t->rx, MBAP_LEN + mbap_len);
+
+            uint16_t rcv_transactionId = read_uint16_reverse(t->rx);
+            struct slot* s = NULL;
+            for (int i = 0; i < t->slot_count && !s; i++)
+                if (t->slots[i].group && t->slots[i].transactionId == rcv_transactionId)
+                    s = &t->slots[i];
+            if (s) {
+                struct transaction* tx = slot_tx(s);
+                memcpy(tx->rsp, t->rx + MBAP_LEN, mbap_len);
+                tx->rsp_len = mbap_len;
+                io_count_copy(mbap_len);
+                target_rtt(t, tx, time_us() - s->sent_us);
+                target_finish(t, s);
+                t->inflight--;
+            } else if (rcv_transactionId == t->broadcast_transactionId && t->rx[MBAP_LEN] == MODBUS_BROADCAST_UNIT) {
+                // Target answered a broadcast, nobody waits for it
+            } else {
+                // Late response of a timed out transaction or garbage
+                log_efln("TransactionMismatch: rcv %u not outstanding", rcv_transactionId);
+                t->errors.transaction_mismatch++;
+                capture_dump_error("unknown transaction ID");
+            }
+            t->rx_len -= MBAP_LEN + mbap_len;
+            memmove(t->rx, t->rx + MBAP_LEN + mbap_len, t->rx_len);
+            io_count_copy(t->rx_len);
+        }
+    }
+}
+
+/// @brief Worker for Modbus TCP targets: up to window outstanding requests,
+/// @brief responses routed by transaction ID, slots freed by per-transaction timeouts
+static void target_loop_tcp(struct target* t) {
+    target_keep_warm(t);
+    while (!isStop()) {
+        config_quiescent(t->config_reader);
+        // Fill the window
+        while (t->inflight < t->window) {
+            struct slot* s = NULL;
+            for (int i = 0; i < t->slot_count && !s; i++)
+                if (!t->slots[i].group)
+                    s = &t->slots[i];
+            if (!target_take(t, s))
+                break;
+            if (!t->inflight)
+                target_check_before_use(t);
+            if (t->sock == INVALID_SOCKET && target_connect(t) != 0) {
+                slot_tx(s)->rsp_len = enSIMPLE_TCP_disconnected;
+                target_finish(t, s);
+                continue;
+            }
+            t->inflight++;
+            if (t->inflight > t->inflight_max)
+                t->inflight_max = t->inflight;
+            int result = tcp_send(t, s);
+            if (result <= 0) {
+                tcp_fail_all(t, result);
+            } else if (slot_tx(s)->req[0] == MODBUS_BROADCAST_UNIT) {
+                // Fire and forget, the slot is free for the next request right away
+                t->broadcast_transactionId = s->transactionId;
+                t->broadcasts++;
+                slot_tx(s)->rsp_len = enSIMPLE_TCP_broadcast;
+                target_finish(t, s);
+                t->inflight--;
+            }
+        }
+
+        // Wait for queue, response or the next deadline
+        uint64_t now = time_us();
+        uint64_t deadline = now + 1000000;
+        for (int i = 0; i < t->slot_count; i++)
+            if (t->slots[i].group && t->slots[i].deadline_us < deadline)
+                deadline = t->slots[i].deadline_us;
+        HANDLE handles[2] = { t->wakeup, t->sock_event };
+        DWORD wait = WaitForMultipleObjects(t->sock != INVALID_SOCKET ? 2 : 1, handles, FALSE,
+            deadline > now ? (DWORD)((deadline - now + 999) / 1000) : 0);
+
+        if (wait == WAIT_OBJECT_0 +1) {
+            WSANETWORKEVENTS events;
+            WSAEnumNetworkEvents(t->sock, t->sock_event, &events);
+            int result = tcp_receive(t);
+            if (result <= 0 && !(result == 0 && !(events.lNetworkEvents & FD_CLOSE)))
+                tcp_fail_all(t, result);
+        } else if (wait == WAIT_TIMEOUT && !t->inflight) {
+            target_keep_warm(t);
+            target_maybe_log_stats(t);
+        }
+
+        // Per-transaction timeouts free the slot, the connection stays
+        now = time_us();
+        for (int i = 0; i < t->slot_count; i++) {
+            struct slot* s = &t->slots[i];
+            if (s->group && s->deadline_us <= now) {
+                log_efln("%s (transaction %u)", simpleTcpInfoStr(enSIMPLE_TCP_error_timeout, "Slave"), s->transactionId);
+                slot_tx(s)->rsp_len = enSIMPLE_TCP_error_timeout;
+                rto_backoff(target_rto(t, slot_tx(s)->req));
+                target_finish(t, s);
+                t->inflight--;
+                t->errors.timeout++;
+            }
+        }
+    }
+}
+
+static DWORD WINAPI target_thread(LPVOID lpParam) {
+    struct target* t = lpParam;
+
+    t->config_reader = config_reader_register();
+    if (t->rtu)
+        target_loop_rtu(t);
+    else
+        target_loop_tcp(t);
+
+    // Service stopped: release outstanding and waiting masters
+    for (int i = 0; i < t->slot_count; i++) {
+        if (t->slots[i].group) {
+            slot_tx(&t->slots[i])->rsp_len = enSIMPLE_TCP_aborted;
+            target_finish(t, &t->slots[i]);
+        }
+    }
+    EnterCriticalSection(&t->lock);
+    struct transaction* tx = t->head;
+    t->head = t->tail = NULL;
+    LeaveCriticalSection(&t->lock);
+    while (tx) {
+        struct transaction* next = tx->next;
+        tx->rsp_len = enSIMPLE_TCP_aborted;
+        tx->done(tx);
+        tx = next;
+    }
+    target_disconnect(t);
+    target_timer_resolution(t, FALSE);
+    config_reader_unregister(t->config_reader);
+    return 0;
+}
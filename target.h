@@ -0,0 +1,182 @@
+/*
+ * File   : target.h
+ * Author : Thomas Mailaender
+ * Date   : 2026-10-17
+ *
+ * Description : Prototypes for the shared upstream connection to a target.
+ *               All masters are multiplexed onto one long-lived connection,
+ *               their requests are queued and sent one at a time (RTU) or
+ *               pipelined up to a window of outstanding ones (Modbus TCP).
+ */
+
+#ifndef __TARGET_H__
+#define __TARGET_H__
+
+#include <stdint.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "comm.h"
+#include "cache.h"
+#include "frame.h"
+#include "stats.h"
+#include "rto.h"
+#include "config.h"
+
+
+struct transaction;
+struct target;
+
+/// @brief Requests of one master: priority class and fair-queuing state on the targets it uses
+struct flow {
+    int priority;                   // Class, queued requests of a higher class are sent first
+    int weight;                     // Share of a target within the class
+    struct target* target;          // Target of the last request, finish is valid there only
+    uint64_t finish;                // Virtual finish time of the last request (target lock)
+
+    // Written by the reactor thread of the master when the response comes back, its requests may
+    // go to several targets
+    struct histogram queue_wait;    // target_submit() until taken by the worker
+    uint64_t dropped;               // Requests dropped, still queued at their deadline
+};
+
+/// @brief Completion callback, called once the response (or error) is stored in the transaction
+typedef void (*transaction_done_fn)(struct transaction* tx);
+
+/// @brief One Modbus request/response, framing independent (unit id + PDU, no MBAP, no CRC)
+struct transaction {
+    struct transaction* next;
+
+    const uint8_t* req;             // Unit id + PDU of the request, in place in the sender's buffer
+    int req_len;
+    uint8_t rsp[BUFFER_SIZE];       // Unit id + PDU of the response
+    int rsp_len;                    // >0 Length of response, <=0 error (see enSIMPLE_TCP)
+
+    uint64_t enqueued_us;           // Timestamp of target_submit()
+    uint64_t taken_us;              // Taken out of the queue by the worker, 0 if not (cache, dropped)
+    uint64_t deadline_us;           // Dropped if still queued after this, 0 never
+    uint64_t start;                 // Virtual start time (weighted fair queuing)
+    uint64_t finish;                // Virtual finish time, smallest is sent first within a class
+    struct flow* flow;              // Master the request comes from, NULL for the gateway's own
+
+    transaction_done_fn done;
+    void* context;
+};
+
+/// @brief Outstanding upstream request: one transaction or a coalesced group with its covering read
+struct slot {
+    struct transaction* group;      // Transactions answered by this request (linked by next), NULL if free
+    int count;                      // Transactions in group
+    struct transaction covering;    // Request actually sent if count > 1
+    uint8_t covering_req[6];        // Unit id + PDU of the covering read
+    uint16_t address;               // Range of the covering read
+    uint16_t quantity;
+    uint16_t transactionId;         // MBAP transaction ID used upstream
+    LONG64 cache_writes;            // cache->writes when sent, see cache_store()
+    uint64_t sent_us;
+    uint64_t deadline_us;           // Slot is failed with timeout after this
+};
+
+/// @brief Upstream target with its own connection, queue and worker thread
+struct target {
+    char host[256];
+    int port;
+    boolean rtu;                    // TRUE: target speaks RTU over TCP, FALSE: Modbus TCP
+
+    SOCKET sock;
+    WSAEVENT sock_event;            // FD_READ/FD_CLOSE of sock (Modbus TCP only)
+    uint16_t transactionId;
+    uint16_t broadcast_transactionId;   // Last broadcast sent (Modbus TCP), a response to it is dropped quietly
+
+    struct slot* slots;             // Outstanding requests, slot_count entries
+    int slot_count;                 // 1 for RTU, CONFIG_MAX_WINDOW for Modbus TCP
+    volatile int window;            // Max outstanding requests (--window), 1 for RTU
+    int inflight;
+    uint8_t rx[MBAP_LEN + BUFFER_SIZE];   // Partially received responses (Modbus TCP)
+    int rx_len;
+    struct rtu_stream rtu_rx;       // Partially received responses (RTU over TCP)
+    DWORD rcv_timeout_ms;           // SO_RCVTIMEO of sock (RTU over TCP)
+    uint64_t used_us;               // Last request sent, for the health check after a pause
+    uint64_t reconnect_us;          // Next background connect attempt (--prewarm)
+    DWORD reconnect_backoff_ms;
+    volatile boolean routed;        // FALSE once a reload routed all its units elsewhere: not reconnected
+    uint32_t capture_id;            // Connection id in traffic captures
+
+    // Pacing of the serial line behind a RTU over TCP target (--baud)
+    volatile uint32_t char_ns;      // One character on the line, 0 not paced
+    volatile uint32_t gap_us;       // Silence between frames: 3.5 characters, 1750 us above 19200 baud
+    boolean timer_held;             // Counted in the holders of the 1 ms timer resolution
+    uint64_t bus_free_us;           // Next frame may start on the line
+
+    CRITICAL_SECTION lock;
+    HANDLE wakeup;                  // Auto-reset, signaled by target_submit()
+    struct transaction* head;
+    struct transaction* tail;
+    uint64_t vtime;                 // Virtual time: start of the last request taken
+
+    struct cache* volatile cache;   // Response cache for reads, NULL until caching is configured
+
+    // Statistics
+    volatile LONG queue_depth;
+    LONG queue_depth_max;
+    uint64_t transactions;
+    uint64_t coalesced;             // Transactions answered by another one's covering read
+    uint64_t broadcasts;            // Requests to unit 0, sent without waiting for a response
+    volatile LONG64 splits;         // Reads above --max-quantity, sent as several requests
+    int inflight_max;
+    uint64_t connects;
+
+    // Metrics, written by the worker thread only
+    struct histogram rtt;           // Upstream round trip (request sent to response received)
+    struct histogram queue_wait;    // target_submit() until taken by the worker
+    struct histogram class_wait[CONFIG_PRIORITY_CLASSES];  // Queue wait per priority class
+    uint64_t dropped;               // Requests dropped at their deadline (--master-timeout)
+    struct error_counters errors;
+    struct rto_estimator rto;       // Response timeout of the target
+    struct rto_estimator rto_units[256];  // Response timeout per unit id (--timeout=unit)
+    uint64_t wait_us_total;
+    uint64_t wait_us_max;
+    uint64_t bus_busy_us;           // Line occupied: request sent until free again (response, gap)
+    uint64_t bus_wire_us;           // Characters of requests and responses on the line
+    uint64_t bus_held_us;           // Sends held back until the line was free
+    uint64_t bus_busy_logged_us;    // bus_busy_us at the last statistics log
+    uint64_t stats_logged_us;
+
+    HANDLE thread;
+    int config_reader;              // Snapshot reader slot of the worker (see config_quiescent)
+};
+
+
+/// @brief Create target and start its worker thread, connection is established on first request
+/// @param host Host-name/IP-adress of target
+/// @param port Port of target
+/// @param rtu TRUE if target speaks RTU over TCP, FALSE for Modbus TCP
+/// @return Target or NULL on error
+struct target* target_create(const char* host, int port, boolean rtu);
+
+/// @brief Apply the current settings: window, bus pacing and response cache (created once caching is configured)
+/// @param t Target
+void target_configure(struct target* t);
+
+/// @brief Queue transaction for the target, returns immediately
+/// @brief Cached reads are completed right away, done() is then called by the caller's thread.
+/// @brief Reads above the unit's --max-quantity are queued as several requests and joined again.
+/// @brief Queued requests are sent by priority class, within a class by weighted fair queuing
+/// @brief over the masters (flow), cost is the size on the wire.
+/// @param t Target
+/// @param tx Transaction (req, done, flow and deadline_us set), owned by the target until done() is called,
+/// @param tx the request buffer must stay valid until then
+void target_submit(struct target* t, struct transaction* tx);
+
+/// @brief Queue transaction and wait for its completion
+/// @param t Target
+/// @param tx Transaction (req set)
+/// @param event Auto-reset event owned by the caller, used to wait for completion
+/// @return >0 Length of response, <=0 error (see enSIMPLE_TCP)
+int target_transact(struct target* t, struct transaction* tx, HANDLE event);
+
+/// @brief Log queue-depth, wait-time, pipeline and cache counters of target
+/// @param t Target
+void target_log_stats(struct target* t);
+
+#endif